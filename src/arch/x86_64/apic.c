@@ -24,6 +24,7 @@
 
 #define LVT_DELIVERY_NMI (0b100 << 8)
 #define LVT_MASK (1 << 16)
+#define LVT_TIMER_TSCDEADLINE (0b10 << 17)
 
 #define TYPE_LAPIC 0
 #define TYPE_IOAPIC 1
@@ -233,6 +234,14 @@ void apic_timerinterruptset(uint8_t vector){
 	lapic_writereg(APIC_TIMER_LVT, vector);
 }
 
+// the deadline msr is ignored until the lvt is in tsc deadline mode,
+// the fence keeps the mmio write ordered before the first wrmsr
+
+void apic_timerdeadlinemode(uint8_t vector){
+	lapic_writereg(APIC_TIMER_LVT, vector | LVT_TIMER_TSCDEADLINE);
+	asm volatile("mfence" : : : "memory");
+}
+
 size_t apic_timerstop(){
 
 	size_t ticksremaining = lapic_readreg(APIC_TIMER_COUNT);
@@ -242,6 +251,10 @@ size_t apic_timerstop(){
 	return ticksremaining;
 }
 
+size_t apic_timerremaining(){
+	return lapic_readreg(APIC_TIMER_COUNT);
+}
+
 size_t apic_timercalibrate(size_t us){
 
 	lapic_writereg(APIC_TIMER_INITIALCOUNT, 0xFFFFFFFF);
@@ -5,6 +5,7 @@
 #include <stdio.h>
 #include <kernel/pmm.h>
 #include <arch/idt.h>
+#include <arch/regs.h>
 
 // initializes things like 
 // syscall, sse, etc
@@ -50,6 +51,14 @@ void cpu_state_init(){
 		"or  $0b11000000000, %%rax;"
 		"mov %%rax, %%cr4;"
 		: : : "rax");
+	
+	arch_regs_fpuinit();
+
+	// monitor/mwait for the idle loop
+
+	__get_cpuid(1, &eax, &ebx, &ecx, &edx);
+
+	arch_getcls()->mwait = ecx & (1 << 3);
 
 	// set up interrupt stacks
 	
@@ -57,5 +66,27 @@ void cpu_state_init(){
 
 	 arch_getcls()->ist.ist1 = pmm_hhdmalloc(10) + PAGE_SIZE*10;
 
+	// double fault stack is 2, a kernel stack overflow ends up here
+
+	 arch_getcls()->ist.ist2 = pmm_hhdmalloc(4) + PAGE_SIZE*4;
+
+
+}
+
+// waits for an interrupt or, with mwait, for another cpu to write to *flag.
+// called with interrupts disabled, sti only takes effect after the next instruction
+// so nothing can slip in between it and the wait
+
+void arch_cpu_idlewait(bool* flag){
+	
+	if(arch_getcls()->mwait){
+		asm volatile("monitor" : : "a"(flag), "c"(0), "d"(0));
+		if(__atomic_load_n(flag, __ATOMIC_SEQ_CST))
+			asm volatile("sti; mwait" : : "a"(0), "c"(0));
+	}
+	else if(__atomic_load_n(flag, __ATOMIC_SEQ_CST))
+		asm volatile("sti; hlt");
+
+	asm volatile("sti");
 
 }
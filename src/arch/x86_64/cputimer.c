@@ -1,9 +1,37 @@
 #include <arch/cputimer.h>
 #include <arch/apic.h>
 #include <arch/idt.h>
+#include <arch/msr.h>
+#include <arch/tsc.h>
+#include <arch/timekeeper.h>
+#include <arch/cls.h>
+#include <kernel/env.h>
+
+// with tsc deadline mode the timer is armed with the tsc value it should fire at,
+// a single msr write. otherwise the lapic counts down from a calibrated tick count.
+// the deadlines passed in are in ns since boot
+
+// the lapic initial count is 32 bits
+#define MAXTICKS 0xFFFFFFFFul
+
+// longer waits get an early interrupt that rearms the timer
+#define MAXDELTA (1ul << 40)
+
+// returns the timer ticks per us
 
 size_t arch_cputimer_init(){
-	// XXX invariant TSC?
+	
+	cls_t* cls = arch_getcls();
+
+	// the deadline has to mean the same thing in every power state,
+	// the timekeeper only calibrates an invariant tsc
+
+	cls->tscdeadline = tsc_deadlinesupported() && arch_timekeeper_tscperus() && !env_isset("notscdeadline");
+
+	if(cls->tscdeadline){
+		apic_timerdeadlinemode(VECTOR_TIMER);
+		return arch_timekeeper_tscperus();
+	}
 	
 	size_t ticks = apic_timercalibrate(1);
 
@@ -13,10 +41,32 @@ size_t arch_cputimer_init(){
 
 }
 
-size_t arch_cputimer_stop(){
-	return apic_timerstop();
+void arch_cputimer_stop(){
+	if(arch_getcls()->tscdeadline)
+		wrmsr(MSR_TSCDEADLINE, 0);
+	else
+		apic_timerstop();
 }
 
-void arch_cputimer_fire(size_t ticks){
-	apic_timerstart(ticks);
+void arch_cputimer_arm(uint64_t deadline, uint64_t now){
+	
+	cls_t* cls = arch_getcls();
+	uint64_t delta = deadline > now ? deadline - now : 0;
+
+	if(delta > MAXDELTA)
+		delta = MAXDELTA;
+
+	// a deadline already in the past fires right away
+
+	if(cls->tscdeadline){
+		wrmsr(MSR_TSCDEADLINE, rdtsc() + delta * cls->timerticksperus / 1000);
+		return;
+	}
+
+	uint64_t us = (delta + 999) / 1000;
+	uint64_t ticks = us > MAXTICKS / cls->timerticksperus ? MAXTICKS : us * cls->timerticksperus;
+
+	// 0 would leave the timer stopped
+	apic_timerstart(ticks ? ticks : 1);
+
 }
@@ -48,6 +48,12 @@ time_t hpet_get_ticksperus(){
 	return ticksper100ns*10;
 }
 
+// counter period in femtoseconds, exact unlike ticksperus
+
+uint64_t hpet_get_period(){
+	return period;
+}
+
 time_t hpet_get_counter(){
 	return readfromreg(REGISTER_COUNTER);
 }
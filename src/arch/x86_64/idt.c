@@ -9,6 +9,7 @@
 // 0x20 -> panic ipi
 // 0x21 -> lapic nmi 
 // 0x22 -> mmu invalidate page ipi
+// 0x23 -> reschedule ipi
 // ...
 // 0x40 -> ps2 keyboard isr
 // ...
@@ -44,7 +45,7 @@ void idt_bspinit(){
 
 	// set error code pushers as exceptions
 	
-	idt_setentry(&idt[VECTOR_DOUBLEFAULT], asmisr_except, 0x28, FLAGS_PRESENT | FLAGS_TYPE_INTERRUPT, 0);
+	idt_setentry(&idt[VECTOR_DOUBLEFAULT], asmisr_doublefault, 0x28, FLAGS_PRESENT | FLAGS_TYPE_INTERRUPT, DOUBLEFAULT_IST);
 	idt_setentry(&idt[VECTOR_GPF], asmisr_except, 0x28, FLAGS_PRESENT | FLAGS_TYPE_INTERRUPT, 0);
 	idt_setentry(&idt[VECTOR_INVALIDTSS], asmisr_except, 0x28, FLAGS_PRESENT | FLAGS_TYPE_INTERRUPT, 0);
 	idt_setentry(&idt[VECTOR_SEGMENTNOTPRESENT], asmisr_except, 0x28, FLAGS_PRESENT | FLAGS_TYPE_INTERRUPT, 0);
@@ -66,6 +67,8 @@ void idt_bspinit(){
 
 	idt_setentry(&idt[VECTOR_LAPICNMI], asmisr_lapicnmi, 0x28, FLAGS_PRESENT | FLAGS_TYPE_INTERRUPT, 0);
 
+	idt_setentry(&idt[VECTOR_RESCHED], asmisr_resched, 0x28, FLAGS_PRESENT | FLAGS_TYPE_INTERRUPT, 0);
+
 	idt_setentry(&idt[VECTOR_TIMER], asmisr_timer, 0x28, FLAGS_PRESENT | FLAGS_TYPE_INTERRUPT, TIMER_IST);
 
 	idt_setentry(&idt[VECTOR_PS2MOUSE], asmisr_ps2mouse, 0x28, FLAGS_PRESENT | FLAGS_TYPE_INTERRUPT, 0);
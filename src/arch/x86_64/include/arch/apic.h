@@ -8,8 +8,10 @@
 void apic_sendipi(uint8_t cpu, uint8_t vec, uint8_t dest, uint8_t mode, uint8_t level);
 void apic_eoi();
 size_t apic_timerstop();
+size_t apic_timerremaining();
 void apic_timerstart(size_t ticks);
 void apic_timerinterruptset(uint8_t vector);
+void apic_timerdeadlinemode(uint8_t vector);
 size_t apic_timercalibrate(size_t us);
 void apic_lapicinit();
 void apic_init();
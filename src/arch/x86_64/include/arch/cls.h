@@ -8,12 +8,19 @@
 #include <kernel/vmm.h>
 #include <kernel/sched.h>
 #include <kernel/timer.h>
+#include <kernel/kstack.h>
+#include <kernel/slab.h>
+#include <arch/spinlock.h>
+#include <kernel/lockstat.h>
 
 // cpu level storage
 // this will be pointed to by GS and will contain per cpu info
 
 typedef struct{
 	void* kstack;
+	// both are reached through gs by spinlock.h
+	size_t preemptcount;
+	size_t needresched;
 	gdt_t gdt;
 	ist_t ist;
 	int lapicid;
@@ -22,11 +29,49 @@ typedef struct{
 	vmm_context *context;
 	thread_t* thread;
 	size_t timerticksperus;
-	timer_req* timerfirstreq;
+	bool tscdeadline;
+	int64_t tscoffset;
+	pid_t tscaux;
+	rbtree_t timers;
+	ticketlock_t timerlock;
 	timer_req  schedreq;
-	bool timerpending;
+	bool quantumarmed;
+	size_t cpunum;
+	thread_t* idlethread;
+	void* schedulerstack;
+	bool idle;
+	bool mwait;
+	size_t idleentries;
+	uint64_t idletime;
+	size_t voluntary;
+	size_t involuntary;
+	size_t latencyhist[SCHED_HISTSIZE];
+	size_t runtimehist[SCHED_HISTSIZE];
+	sched_queue queues[QUEUE_COUNT];
+	size_t queuedthreads;
+	uint64_t rtperiodstart;
+	uint64_t rtruntime;
+	bool rtthrottled;
+	size_t rtthrottles;
+	size_t steals;
+	size_t migrations;
+	arch_extraregs* fpuowner;
+	void* kstackcache[KSTACK_CACHE_SIZE];
+	size_t kstackcachecount;
+	slab_cpucache slabcaches[SLAB_MAXCACHES];
+	bool pcid;
+	arch_mmu_tableptr pcidslots[ARCH_MMU_PCID_SLOTS];
+	size_t pcidnext;
+	uint64_t rcuepoch;
+	size_t rcunesting;
+	#ifdef LOCKSTAT
+	lockstat_held lockstatheld[LOCKSTAT_DEPTH];
+	size_t lockstatdepth;
+	#endif
 } cls_t;
 
+_Static_assert(__builtin_offsetof(cls_t, preemptcount) == 8 && __builtin_offsetof(cls_t, needresched) == 16, "spinlock.h expects the preempt count at gs:8");
+
 void bsp_setcls();
 void arch_setcls(cls_t* addr);
 cls_t* arch_getcls();
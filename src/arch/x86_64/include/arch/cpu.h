@@ -1,6 +1,9 @@
 #ifndef _CPU_H_INCLUDE
 #define _CPU_H_INCLUDE
 
+#include <stdbool.h>
+
 void cpu_state_init();
+void arch_cpu_idlewait(bool* flag);
 
 #endif
@@ -2,9 +2,10 @@
 #define _CPUTIMER_H_INCLUDE
 
 #include <stddef.h>
+#include <stdint.h>
 
 size_t arch_cputimer_init();
-size_t arch_cputimer_stop();
-void arch_cputimer_fire(size_t ticks);
+void arch_cputimer_stop();
+void arch_cputimer_arm(uint64_t deadline, uint64_t now);
 
 #endif
@@ -2,6 +2,7 @@
 #define _HPET_H_INCLUDE
 
 #include <stddef.h>
+#include <stdint.h>
 #include <time.h>
 
 void hpet_init();
@@ -11,5 +12,6 @@ void hpet_wait_ms(size_t ms);
 void hpet_wait_s(size_t s);
 time_t hpet_get_counter();
 time_t hpet_get_ticksperus();
+uint64_t hpet_get_period();
 
 #endif
@@ -29,12 +29,14 @@
 #define VECTOR_PANIC 0x20
 #define VECTOR_LAPICNMI 0x21
 #define VECTOR_MMUINVAL 0x22
+#define VECTOR_RESCHED 0x23
 #define VECTOR_PS2MOUSE 0x3F
 #define VECTOR_NVME 0x60
 #define VECTOR_PS2KBD   0x40
 #define VECTOR_TIMER 0x80
 
 #define TIMER_IST 1
+#define DOUBLEFAULT_IST 2
 
 typedef struct{
 	uint16_t size;
@@ -1,6 +1,8 @@
 #ifndef _ARCH_INTERRUPT_H_INCLUDE
 #define _ARCH_INTERRUPT_H_INCLUDE
 
+#include <stdbool.h>
+
 static inline void arch_interrupt_disable(){
 	asm("cli");
 }
@@ -9,6 +11,19 @@ static inline void arch_interrupt_enable(){
 	asm("sti");
 }
 
+// disables interrupts and returns whether they were enabled before
+
+static inline bool arch_interrupt_save(){
+	unsigned long flags;
+	asm volatile("pushfq; pop %0; cli" : "=r"(flags) : : "memory");
+	return flags & 0x200;
+}
+
+static inline void arch_interrupt_restore(bool enabled){
+	if(enabled)
+		asm volatile("sti" : : : "memory");
+}
+
 static inline void arch_halt(){
 	asm("hlt");
 }
@@ -10,12 +10,14 @@ extern void asmisr_pagefault();
 extern void asmisr_panic();
 extern void asmisr_lapicnmi();
 extern void asmisr_mmuinval();
+extern void asmisr_resched();
 extern void asmisr_ps2mouse();
 extern void asmisr_ps2kbd();
 extern void asmisr_timer();
 extern void asmisr_simd();
 extern void asmisr_nm();
 extern void asmisr_gpf();
+extern void asmisr_doublefault();
 extern void asmisr_nvme();
 
 #endif
@@ -13,6 +13,10 @@
 #define ARCH_MMU_MAP_NOEXEC       (uint64_t)(1 << 63)
 #define ARCH_MMU_MAP_PAGESIZE     (uint64_t)(1 << 7)
 #define ARCH_MMU_MAP_ACCESSED	  (uint64_t)(1 << 5)
+#define ARCH_MMU_MAP_GLOBAL       (uint64_t)(1 << 8)
+
+// address spaces a cpu keeps tagged tlb entries for, pcid n+1 belongs to slot n
+#define ARCH_MMU_PCID_SLOTS 32
 
 #define ARCH_MMU_ERROR_WRITE 2
 #define ARCH_MMU_ERROR_PRESENT 1
@@ -11,6 +11,8 @@
 #define MSR_FSBASE 0xC0000100
 #define MSR_GSBASE 0xC0000101
 #define MSR_KERNELGSBASE 0xC0000102
+#define MSR_TSCAUX 0xC0000103
+#define MSR_TSCDEADLINE 0x6E0
 
 static inline uint64_t rdmsr(uint32_t which){
 	uint64_t low,high;
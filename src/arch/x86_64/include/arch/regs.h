@@ -8,8 +8,10 @@ typedef uint64_t arch_reg;
 
 typedef struct{
 	uint64_t gsbase, fsbase;
-	uint8_t  fx[512];
-	uint32_t mxcsr;
+	void* fpu; // xsave or fxsave area, 64 byte aligned
+	void* fpubase;
+	int fpucpu; // cpu the state was last loaded on
+	bool fpudirty; // the registers hold newer state than the save area
 } arch_extraregs;
 
 typedef struct{
@@ -17,8 +19,12 @@ typedef struct{
 } arch_regs;
 void arch_regs_saveextra(arch_extraregs* regs);
 void arch_regs_setupextra(arch_extraregs* regs);
+void arch_regs_copyextra(arch_extraregs* to, arch_extraregs* from);
+void arch_regs_freeextra(arch_extraregs* xregs);
+void arch_regs_fputrap();
+void arch_regs_fpuinit();
 
-void arch_regs_firsttimesetup(arch_regs* regs, arch_extraregs* xregs);
+int arch_regs_firsttimesetup(arch_regs* regs, arch_extraregs* xregs);
 
 void arch_regs_setupkernel(arch_regs* regs, void* ip, void* stack, bool interrupts);
 void arch_regs_setupuser(arch_regs* regs, void* ip, void* stack, bool interrupts);
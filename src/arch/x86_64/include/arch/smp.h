@@ -2,6 +2,7 @@
 #define _SMP_H_INCLUDE
 
 #include <stddef.h>
+#include <arch/cls.h>
 
 void smp_init();
 
@@ -12,6 +13,9 @@ void smp_init();
 
 void arch_smp_sendipi(int cpu, int vector, int mode);
 size_t arch_smp_cpucount();
+cls_t* arch_smp_getcls(size_t cpu);
+void arch_smp_resched(cls_t* cpu);
+void arch_smp_wakeidle(cls_t* cpu);
 
 
 #endif
@@ -2,17 +2,352 @@
 #define _SPINLOCK_H_INCLUDE
 
 #include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <arch/interrupt.h>
 
-static inline void spinlock_acquire(int *lock){
-	while(!__sync_bool_compare_and_swap(lock, 0, 1)) asm("pause");
+// with LOCKSTAT the acquire and release functions aren't inlined, so the
+// address they return to tells where the lock was taken
+
+#ifdef LOCKSTAT
+
+#include <arch/tsc.h>
+#include <kernel/lockstat.h>
+
+#define LOCKFUNC __attribute__((noinline, unused)) static
+#define LOCKSTAT_START(var) uint64_t var = rdtsc()
+#define LOCKSTAT_CONTENDED(var) bool var = false
+#define LOCKSTAT_SETCONTENDED(var) var = true
+#define LOCKSTAT_ACQUIRED(lock, start, contended) lockstat_acquired(__builtin_return_address(0), lock, start, contended)
+#define LOCKSTAT_RELEASED(lock) lockstat_released(lock)
+
+#else
+
+#define LOCKFUNC static inline
+#define LOCKSTAT_START(var)
+#define LOCKSTAT_CONTENDED(var)
+#define LOCKSTAT_SETCONTENDED(var)
+#define LOCKSTAT_ACQUIRED(lock, start, contended)
+#define LOCKSTAT_RELEASED(lock)
+
+#endif
+
+// the preempt count and the resched flag of the running thread live at fixed
+// offsets of the cpu level storage (see cls.h), so they can be reached through
+// gs without including it. the timer won't switch threads while the count is
+// above 0, it sets the flag instead and the switch happens once it drops to 0
+
+#define PREEMPT_COUNT "%%gs:8"
+#define PREEMPT_NEEDRESCHED "%%gs:16"
+
+void sched_preempt();
+
+static inline void preempt_disable(){
+	asm volatile("incq " PREEMPT_COUNT : : : "memory");
+}
+
+// drops the count without acting on a pending resched
+
+static inline void preempt_enablenoresched(){
+	asm volatile("decq " PREEMPT_COUNT : : : "memory");
+}
+
+static inline void preempt_enable(){
+
+	bool zero;
+
+	asm volatile("decq " PREEMPT_COUNT : "=@ccz"(zero) : : "memory");
+
+	if(zero){
+		unsigned long needresched;
+		asm volatile("movq " PREEMPT_NEEDRESCHED ", %0" : "=r"(needresched));
+		if(needresched)
+			sched_preempt();
+	}
+
+}
+
+// acts on a resched that came in while interrupts were off
+
+static inline void preempt_check(){
+
+	unsigned long count, needresched;
+
+	asm volatile("movq " PREEMPT_COUNT ", %0" : "=r"(count));
+	asm volatile("movq " PREEMPT_NEEDRESCHED ", %0" : "=r"(needresched));
+
+	if(count == 0 && needresched)
+		sched_preempt();
+
+}
+
+// true if the timer is waiting for the only lock held to be let go
+
+static inline bool preempt_needbreak(){
+
+	unsigned long count, needresched;
+
+	asm volatile("movq " PREEMPT_COUNT ", %0" : "=r"(count));
+	asm volatile("movq " PREEMPT_NEEDRESCHED ", %0" : "=r"(needresched));
+
+	return count == 1 && needresched;
+
+}
+
+// the lock is only written once it was seen free, so waiters don't keep
+// taking the cache line from each other
+
+LOCKFUNC void spinlock_acquire(int *lock){
+	
+	LOCKSTAT_START(start);
+	LOCKSTAT_CONTENDED(contended);
+
+	preempt_disable();
+
+	while(!__sync_bool_compare_and_swap(lock, 0, 1)){
+		LOCKSTAT_SETCONTENDED(contended);
+		while(__atomic_load_n(lock, __ATOMIC_RELAXED))
+			asm volatile("pause");
+	}
+
+	LOCKSTAT_ACQUIRED(lock, start, contended);
+
+}
+
+LOCKFUNC bool spinlock_trytoacquire(int *lock){
+
+	LOCKSTAT_START(start);
+
+	preempt_disable();
+
+	if(__sync_bool_compare_and_swap(lock, 0, 1)){
+		LOCKSTAT_ACQUIRED(lock, start, false);
+		return true;
+	}
+
+	preempt_enablenoresched();
+
+	return false;
+
+}
+
+LOCKFUNC void spinlock_release(int *lock){
+	LOCKSTAT_RELEASED(lock);
+	__atomic_store_n(lock, 0, __ATOMIC_RELEASE);
+	preempt_enable();
+}
+
+// a preemption point for long loops under a lock. if the timer wanted the cpu
+// and this is the only lock held, it is dropped so the switch can happen.
+// returns true if it was dropped, anything it protected has to be looked up again
+
+static inline bool spinlock_break(int *lock){
+
+	if(!preempt_needbreak())
+		return false;
+
+	spinlock_release(lock);
+	spinlock_acquire(lock);
+
+	return true;
+
+}
+
+// the _irqsave variants disable interrupts for as long as the lock is held,
+// for locks that are also taken by interrupt handlers
+
+static inline bool spinlock_acquireirqsave(int *lock){
+	bool intstate = arch_interrupt_save();
+	spinlock_acquire(lock);
+	return intstate;
+}
+
+static inline void spinlock_releaseirqrestore(int *lock, bool intstate){
+	LOCKSTAT_RELEASED(lock);
+	__atomic_store_n(lock, 0, __ATOMIC_RELEASE);
+	preempt_enablenoresched();
+	arch_interrupt_restore(intstate);
+	if(intstate)
+		preempt_check();
+}
+
+// ticket locks hand the lock out in the order it was asked for.
+// a zeroed lock is unlocked
+
+typedef struct{
+	uint32_t next;
+	uint32_t owner;
+} ticketlock_t;
+
+LOCKFUNC void ticketlock_acquire(ticketlock_t *lock){
+	
+	LOCKSTAT_START(start);
+	LOCKSTAT_CONTENDED(contended);
+
+	preempt_disable();
+
+	uint32_t ticket = __atomic_fetch_add(&lock->next, 1, __ATOMIC_RELAXED);
+
+	while(__atomic_load_n(&lock->owner, __ATOMIC_ACQUIRE) != ticket){
+		LOCKSTAT_SETCONTENDED(contended);
+		asm volatile("pause");
+	}
+
+	LOCKSTAT_ACQUIRED(lock, start, contended);
+
+}
+
+LOCKFUNC bool ticketlock_trytoacquire(ticketlock_t *lock){
+
+	LOCKSTAT_START(start);
+
+	preempt_disable();
+
+	// the lock is free if nobody holds a ticket past the owner
+	
+	uint32_t owner = __atomic_load_n(&lock->owner, __ATOMIC_RELAXED);
+
+	if(__atomic_compare_exchange_n(&lock->next, &owner, owner + 1, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)){
+		LOCKSTAT_ACQUIRED(lock, start, false);
+		return true;
+	}
+
+	preempt_enablenoresched();
+
+	return false;
+
+}
+
+// only the holder writes the owner
+
+LOCKFUNC void ticketlock_release(ticketlock_t *lock){
+	LOCKSTAT_RELEASED(lock);
+	__atomic_store_n(&lock->owner, lock->owner + 1, __ATOMIC_RELEASE);
+	preempt_enable();
+}
+
+static inline bool ticketlock_break(ticketlock_t *lock){
+
+	if(!preempt_needbreak())
+		return false;
+
+	ticketlock_release(lock);
+	ticketlock_acquire(lock);
+
+	return true;
+
+}
+
+static inline bool ticketlock_acquireirqsave(ticketlock_t *lock){
+	bool intstate = arch_interrupt_save();
+	ticketlock_acquire(lock);
+	return intstate;
+}
+
+static inline void ticketlock_releaseirqrestore(ticketlock_t *lock, bool intstate){
+	LOCKSTAT_RELEASED(lock);
+	__atomic_store_n(&lock->owner, lock->owner + 1, __ATOMIC_RELEASE);
+	preempt_enablenoresched();
+	arch_interrupt_restore(intstate);
+	if(intstate)
+		preempt_check();
+}
+
+// mcs locks queue the waiters, each spins on its own node instead of the
+// lock. the node is passed to acquire and release and usually lives on the
+// stack of the holder. a zeroed lock is unlocked
+
+typedef struct mcsnode_t{
+	struct mcsnode_t* next;
+	int locked;
+} mcsnode_t;
+
+typedef struct{
+	mcsnode_t* tail;
+} mcslock_t;
+
+LOCKFUNC void mcslock_acquire(mcslock_t *lock, mcsnode_t *node){
+	
+	LOCKSTAT_START(start);
+
+	preempt_disable();
+
+	node->next = NULL;
+	node->locked = 1;
+
+	mcsnode_t* prev = __atomic_exchange_n(&lock->tail, node, __ATOMIC_ACQ_REL);
+
+	if(prev){
+		__atomic_store_n(&prev->next, node, __ATOMIC_RELEASE);
+
+		while(__atomic_load_n(&node->locked, __ATOMIC_ACQUIRE))
+			asm volatile("pause");
+	}
+
+	LOCKSTAT_ACQUIRED(lock, start, prev != NULL);
+
+}
+
+LOCKFUNC bool mcslock_trytoacquire(mcslock_t *lock, mcsnode_t *node){
+	
+	LOCKSTAT_START(start);
+
+	preempt_disable();
+
+	node->next = NULL;
+	node->locked = 1;
+
+	mcsnode_t* expected = NULL;
+
+	if(__atomic_compare_exchange_n(&lock->tail, &expected, node, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)){
+		LOCKSTAT_ACQUIRED(lock, start, false);
+		return true;
+	}
+
+	preempt_enablenoresched();
+
+	return false;
+
+}
+
+static inline void mcsunlock(mcslock_t *lock, mcsnode_t *node){
+
+	LOCKSTAT_RELEASED(lock);
+
+	mcsnode_t* next = __atomic_load_n(&node->next, __ATOMIC_ACQUIRE);
+
+	if(!next){
+		mcsnode_t* expected = node;
+		if(__atomic_compare_exchange_n(&lock->tail, &expected, NULL, false, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+			return;
+
+		// someone swapped in behind us and has yet to link itself
+
+		while(!(next = __atomic_load_n(&node->next, __ATOMIC_ACQUIRE)))
+			asm volatile("pause");
+	}
+
+	__atomic_store_n(&next->locked, 0, __ATOMIC_RELEASE);
+
+}
+
+LOCKFUNC void mcslock_release(mcslock_t *lock, mcsnode_t *node){
+	mcsunlock(lock, node);
+	preempt_enable();
 }
 
-static inline bool spinlock_trytoacquire(int *lock){
-	return __sync_bool_compare_and_swap(lock, 0, 1);
+static inline bool mcslock_acquireirqsave(mcslock_t *lock, mcsnode_t *node){
+	bool intstate = arch_interrupt_save();
+	mcslock_acquire(lock, node);
+	return intstate;
 }
 
-static inline void spinlock_release(int *lock){
-	*lock = 0;
+static inline void mcslock_releaseirqrestore(mcslock_t *lock, mcsnode_t *node, bool intstate){
+	mcsunlock(lock, node);
+	preempt_enablenoresched();
+	arch_interrupt_restore(intstate);
+	if(intstate)
+		preempt_check();
 }
 
 #endif
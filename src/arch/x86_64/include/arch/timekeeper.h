@@ -2,10 +2,16 @@
 #define _TIMEKEEPER_H_INCLUDE
 
 #include <time.h>
+#include <stdint.h>
+#include <stddef.h>
 
 struct timespec arch_timekeeper_gettime();
 struct timespec arch_timekeeper_gettimefromboot();
+uint64_t arch_timekeeper_nsfromboot();
+const char* arch_timekeeper_source();
+size_t arch_timekeeper_tscperus();
 
 void arch_timekeeper_init();
+void arch_timekeeper_apinit();
 
 #endif
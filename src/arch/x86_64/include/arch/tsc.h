@@ -0,0 +1,37 @@
+#ifndef _TSC_H_INCLUDE
+#define _TSC_H_INCLUDE
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <cpuid.h>
+
+static inline uint64_t rdtsc(){
+	uint32_t low, high;
+	asm volatile("rdtsc" : "=a"(low), "=d"(high));
+	return ((uint64_t)high << 32) | low;
+}
+
+// the tsc runs at a constant rate in every p and c state
+
+static inline bool tsc_invariant(){
+	uint32_t eax, ebx, ecx, edx;
+	if(!__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx))
+		return false;
+	return edx & (1 << 8);
+}
+
+static inline bool tsc_deadlinesupported(){
+	uint32_t eax, ebx, ecx, edx;
+	if(!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+		return false;
+	return ecx & (1 << 24);
+}
+
+static inline bool tsc_rdtscpsupported(){
+	uint32_t eax, ebx, ecx, edx;
+	if(!__get_cpuid(0x80000001, &eax, &ebx, &ecx, &edx))
+		return false;
+	return edx & (1 << 27);
+}
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef _VDSO_H_INCLUDE
+#define _VDSO_H_INCLUDE
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// this header is also used to build the vdso image itself
+
+// the vdso area sits below the stack of every process:
+// the time page, shared by everyone
+// the process page, private to each process
+// the vdso image, shared by everyone
+#define VDSO_PAGESIZE 4096
+#define VDSO_BASE 0x7FFF00000000ul
+#define VDSO_TIMEPAGE VDSO_BASE
+#define VDSO_PROCPAGE (VDSO_BASE + VDSO_PAGESIZE)
+#define VDSO_IMAGE (VDSO_BASE + VDSO_PAGESIZE*2)
+
+// how the vdso can read the clock
+#define VDSO_CLOCK_SYSCALL 0
+#define VDSO_CLOCK_TSC 1
+
+// the seq count is odd while the kernel is changing the page
+
+typedef struct{
+	uint32_t seq;
+	uint32_t clockmode;
+	uint64_t tscbase;
+	uint64_t tscmult;
+	int64_t bootunixtime;
+	// tsc_aux holds the id of the running thread
+	uint32_t tidintscaux;
+} vdso_timedata;
+
+typedef struct{
+	int32_t pid;
+} vdso_procdata;
+
+#ifndef VDSO_IMAGE_BUILD
+
+#include <kernel/vmm.h>
+#include <kernel/sched.h>
+
+extern bool vdso_tidintscaux;
+
+void arch_vdso_init();
+void arch_vdso_settime(uint32_t clockmode, uint64_t tscbase, uint64_t tscmult, int64_t bootunixtime);
+int arch_vdso_map(proc_t* proc, uint64_t* ehdr);
+void arch_vdso_fork(vmm_context* ctx, proc_t* proc);
+
+#endif
+
+#endif
@@ -153,11 +153,13 @@ asmisr_panic:
 isr 	asmisr_nvme, nvme_irq, 0x30
 except	asmisr_pagefault, isr_pagefault, 0xE
 except  asmisr_gpf, isr_gpf, 0xD
-except	asmisr_nm, isr_except, 0x7
+except	asmisr_doublefault, isr_doublefault, 0x8
+isr	asmisr_nm, isr_nm, 0x7
 isr	asmisr_general, isr_general, 0xFF
 except	asmisr_except, isr_except, 0xFF
 isr	asmisr_lapicnmi, isr_lapicnmi, 0x21
 isr	asmisr_mmuinval, isr_mmuinval, 0x22
+isr	asmisr_resched, isr_resched, 0x23
 isr	asmisr_ps2mouse, isr_ps2mouse, 0x3F
 isr 	asmisr_ps2kbd, isr_ps2kbd, 0x40
 isr	asmisr_timer, isr_timer, 0x80
@@ -57,6 +57,16 @@ void isr_pagefault(arch_regs *reg){
 	
 }
 
+// runs on its own stack so a kernel stack overflow can still be reported
+
+void isr_doublefault(arch_regs* reg){
+	_panic("Double fault (kernel stack overflow?)", reg);
+}
+
+void isr_nm(arch_regs* reg){
+	arch_regs_fputrap();
+}
+
 void isr_lapicnmi(){
 	_panic("Local apic NMI", 0);
 }
@@ -66,6 +76,11 @@ void isr_mmuinval(){
 	apic_eoi();
 }
 
+void isr_resched(){
+	sched_resched();
+	apic_eoi();
+}
+
 void isr_ps2kbd(arch_regs* reg){
 	ps2kbd_irq();
 	apic_eoi();
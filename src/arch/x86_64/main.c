@@ -19,13 +19,17 @@
 #include <kernel/timer.h>
 #include <kernel/keyboard.h>
 #include <arch/timekeeper.h>
+#include <arch/vdso.h>
+#include <kernel/lockstat.h>
 
 void kmain(){
 
-	liminetty_init();
+	// spinlocks touch the cls, so it has to be set up first
 
 	bsp_setcls();
 
+	liminetty_init();
+
 	gdt_init();
 
 	idt_bspinit();
@@ -52,11 +56,15 @@ void kmain(){
 
 	hpet_init();
 
+	arch_vdso_init();
+
 	arch_timekeeper_init();
 
 	timer_init();
 
 	vfs_init();
+
+	fd_init();
 	
 	printf("Mounting tmpfs in /\n");
 
@@ -87,6 +95,14 @@ void kmain(){
 
 	smp_init();
 
+	schedstat_init();
+
+	#ifdef LOCKSTAT
+
+	lockstat_init();
+
+	#endif
+
 	nvme_init();
 
 	keyboard_init();
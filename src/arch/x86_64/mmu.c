@@ -11,6 +11,8 @@
 #include <arch/idt.h>
 #include <arch/smp.h>
 #include <kernel/semaphore.h>
+#include <arch/interrupt.h>
+#include <cpuid.h>
 
 volatile struct limine_kernel_address_request kaddrreq = {
 	.id = LIMINE_KERNEL_ADDRESS_REQUEST,
@@ -26,26 +28,106 @@ static void changeentry(uint64_t* entry, void* paddr, uint64_t flags){
 
 #define PTR_FLAGS ARCH_MMU_MAP_READ | ARCH_MMU_MAP_WRITE | ARCH_MMU_MAP_USER | ARCH_MMU_MAP_NOEXEC
 
-void arch_mmu_switchcontext(arch_mmu_tableptr context){
-	asm("mov %%rax, %%cr3" : : "a"(context) : "memory");
+#define CR3_NOFLUSH ((uint64_t)1 << 63)
+#define CR4_PGE   (1 << 7)
+#define CR4_PCIDE (1 << 17)
+
+static arch_mmu_tableptr context; //boostrap context; also holds the kernel page tables
+
+// kernel half mappings are the same in every address space so they are global
+// and survive cr3 loads. invlpg drops global entries no matter the pcid
+
+static uint64_t leafflags(void* vaddr, uint64_t flags){
+	if((uint64_t)vaddr >= 0xFFFF800000000000 && (flags & ARCH_MMU_MAP_READ))
+		flags |= ARCH_MMU_MAP_GLOBAL;
+	return flags;
+}
+
+static arch_mmu_tableptr loadedcontext(){
+	uint64_t cr3;
+	asm volatile("mov %%cr3, %%rax" : "=a"(cr3));
+	return (arch_mmu_tableptr)(cr3 & ~((uint64_t)0xFFF) & ~CR3_NOFLUSH);
+}
+
+static int pcidslot(cls_t* cls, arch_mmu_tableptr ctx){
+	for(int i = 0; i < ARCH_MMU_PCID_SLOTS; ++i){
+		if(cls->pcidslots[i] == ctx)
+			return i;
+	}
+	return -1;
+}
+
+// every cpu hands out its pcids round robin. a slot that gets a new address space
+// is loaded without the no flush bit, which drops whatever the pcid had cached.
+// the bootstrap context always uses pcid 0
+
+void arch_mmu_switchcontext(arch_mmu_tableptr ctx){
+	
+	bool enabled = arch_interrupt_save();
+
+	cls_t* cls = arch_getcls();
+	uint64_t cr3 = (uint64_t)ctx;
+
+	if(cls->pcid && ctx != context){
+		int slot = pcidslot(cls, ctx);
+		if(slot == -1){
+			slot = cls->pcidnext;
+			cls->pcidnext = (cls->pcidnext + 1) % ARCH_MMU_PCID_SLOTS;
+			cls->pcidslots[slot] = ctx;
+		}
+		else cr3 |= CR3_NOFLUSH;
+
+		cr3 |= slot + 1;
+	}
+
+	asm("mov %%rax, %%cr3" : : "a"(cr3) : "memory");
+
+	arch_interrupt_restore(enabled);
+
+}
+
+// invlpg only reaches the loaded pcid, any other cpu just forgets the address space
+// so its next load of it flushes. addr NULL forgets it in any case
+
+static void invalidatelocal(arch_mmu_tableptr ctx, void* addr){
+	
+	cls_t* cls = arch_getcls();
+
+	if(addr && (!cls->pcid || (uint64_t)addr >= 0xFFFF800000000000 || ctx == loadedcontext())){
+		asm("invlpg (%%rax)" : : "a"(addr));
+		return;
+	}
+
+	int slot = pcidslot(cls, ctx);
+
+	if(slot != -1)
+		cls->pcidslots[slot] = NULL;
+
 }
 
 void* inv = NULL;
+arch_mmu_tableptr invctx;
 int invlock;
 semaphore_t sem;
 
 void arch_mmu_invalidateipi(){
-	asm("invlpg (%%rax)" : : "a"(inv));
+	invalidatelocal(invctx, inv);
 	sem_signal(&sem);
 }
 
-static void invalidate(void* addr){
+static void invalidate(arch_mmu_tableptr ctx, void* addr){
 	spinlock_acquire(&invlock);
-	asm("invlpg (%%rax)" : : "a"(addr));
+	bool enabled = arch_interrupt_save();
+	invalidatelocal(ctx, addr);
+	arch_interrupt_restore(enabled);
 	sem.count = -arch_smp_cpucount();
-	if(!sem.count) return;
+	if(!sem.count){
+		spinlock_release(&invlock);
+		return;
+	}
 	sem.count += 2;
 	inv = addr;
+	invctx = ctx;
 	arch_smp_sendipi(0, VECTOR_MMUINVAL, IPI_CPU_ALLBUTSELF);
 	while(!sem_tryacquire(&sem)) asm("pause");
 	spinlock_release(&invlock);
@@ -173,10 +255,15 @@ static void destroy(uint64_t* table, int depth){
 
 }
 
-void arch_mmu_destroy(arch_mmu_tableptr context){
-	if(context < limine_hhdm_offset)
-		context = (uint8_t*)context + (uintptr_t)limine_hhdm_offset;
-	destroy(context, 0);
+// no cpu may keep tagged entries for the tables as they can be reused
+
+void arch_mmu_destroy(arch_mmu_tableptr ctx){
+	arch_mmu_tableptr table = ctx;
+	if(table < limine_hhdm_offset)
+		table = (uint8_t*)table + (uintptr_t)limine_hhdm_offset;
+	destroy(table, 0);
+	invalidate(ctx, NULL);
+	pmm_free(ctx, 1);
 }
 
 bool arch_mmu_isaccessed(arch_mmu_tableptr context, void* addr){
@@ -192,9 +279,9 @@ void arch_mmu_changeflags(arch_mmu_tableptr context, void* addr, size_t flags, s
 
 		mapping &= ~((uint64_t)0xFFF); // get addr
 		mapping &= ~((uint64_t)1 << 63);
-		mapping |= flags;
+		mapping |= leafflags(addr, flags);
 		setpage(context, addr, mapping);
-		invalidate(addr);
+		invalidate(context, addr);
 		addr += PAGE_SIZE;
 	}
 
@@ -203,7 +290,7 @@ void arch_mmu_changeflags(arch_mmu_tableptr context, void* addr, size_t flags, s
 
 int arch_mmu_map(arch_mmu_tableptr context, void* paddr, void* vaddr, size_t flags){
 	uint64_t entry;
-	changeentry(&entry, paddr, flags);
+	changeentry(&entry, paddr, leafflags(vaddr, flags));
 
 	int ret = setpage(context, vaddr, entry);
 	
@@ -216,12 +303,10 @@ void arch_mmu_unmap(arch_mmu_tableptr context, void* vaddr){
 	if(!getmapping(context, vaddr)) return;
 
 	arch_mmu_map(context, 0, vaddr, 0);
-	invalidate(vaddr);
+	invalidate(context, vaddr);
 	
 }
 
-static arch_mmu_tableptr context; //boostrap context; also holds the kernel page tables
-
 arch_mmu_tableptr arch_mmu_newcontext(){
 	
 	arch_mmu_tableptr newcontext = pmm_alloc(1);
@@ -236,6 +321,29 @@ arch_mmu_tableptr arch_mmu_newcontext(){
 
 }
 
+// global pages and pcids for the current cpu, has to run in the bootstrap context (pcid 0)
+
+static void cpuinit(){
+	
+	unsigned int eax, ebx, ecx, edx;
+	uint64_t cr4;
+
+	__get_cpuid(1, &eax, &ebx, &ecx, &edx);
+
+	asm volatile("mov %%cr4, %%rax" : "=a"(cr4));
+
+	if(edx & (1 << 13))
+		cr4 |= CR4_PGE;
+
+	if(ecx & (1 << 17)){
+		cr4 |= CR4_PCIDE;
+		arch_getcls()->pcid = true;
+	}
+
+	asm volatile("mov %%rax, %%cr4" : : "a"(cr4) : "memory");
+
+}
+
 void arch_mmu_init(){
 	
 	context = pmm_alloc(1);
@@ -270,7 +378,7 @@ void arch_mmu_init(){
 			changeentry(&entry, addr + pageoffset*PAGE_SIZE, ARCH_MMU_MAP_READ | ARCH_MMU_MAP_WRITE);
 
 			setpage(context, addr + pageoffset*PAGE_SIZE, entry);
-			setpage(context, addr + pageoffset*PAGE_SIZE + (size_t)limine_hhdm_offset, entry);
+			setpage(context, addr + pageoffset*PAGE_SIZE + (size_t)limine_hhdm_offset, entry | ARCH_MMU_MAP_GLOBAL);
 			
 		}
 
@@ -301,7 +409,7 @@ void arch_mmu_init(){
 
 	for(void* addr = textstart; addr < textend; addr += PAGE_SIZE){
 		uint64_t entry;
-		changeentry(&entry, kphysical, ARCH_MMU_MAP_READ);
+		changeentry(&entry, kphysical, ARCH_MMU_MAP_READ | ARCH_MMU_MAP_GLOBAL);
 		setpage(context, addr, entry);
 
 		kphysical += PAGE_SIZE;
@@ -309,7 +417,7 @@ void arch_mmu_init(){
 
 	for(void* addr = rodatastart; addr < rodataend; addr += PAGE_SIZE){
 		uint64_t entry;
-		changeentry(&entry, kphysical, ARCH_MMU_MAP_READ | ARCH_MMU_MAP_NOEXEC);
+		changeentry(&entry, kphysical, ARCH_MMU_MAP_READ | ARCH_MMU_MAP_NOEXEC | ARCH_MMU_MAP_GLOBAL);
 		setpage(context, addr, entry);
 
 		kphysical += PAGE_SIZE;
@@ -317,7 +425,7 @@ void arch_mmu_init(){
 
 	for(void* addr = datastart; addr < dataend; addr += PAGE_SIZE){
 		uint64_t entry;
-		changeentry(&entry, kphysical, ARCH_MMU_MAP_READ | ARCH_MMU_MAP_WRITE | ARCH_MMU_MAP_NOEXEC);
+		changeentry(&entry, kphysical, ARCH_MMU_MAP_READ | ARCH_MMU_MAP_WRITE | ARCH_MMU_MAP_NOEXEC | ARCH_MMU_MAP_GLOBAL);
 		setpage(context, addr, entry);
 
 		kphysical += PAGE_SIZE;
@@ -327,6 +435,8 @@ void arch_mmu_init(){
 	arch_mmu_switchcontext(context);
 	arch_getcls()->context->context = context;
 
+	cpuinit();
+
 	printf("In bootstrap context\n");
 
 }
@@ -335,6 +445,8 @@ void arch_mmu_apinit(){
 	
 	arch_mmu_switchcontext(context);
 
+	cpuinit();
+
 	arch_getcls()->context = pmm_hhdmalloc(1);
 
 	arch_getcls()->context->context = context;
@@ -1,24 +1,201 @@
 #include <arch/regs.h>
 #include <arch/msr.h>
+#include <arch/cls.h>
+#include <arch/interrupt.h>
+#include <arch/vdso.h>
+#include <kernel/alloc.h>
+#include <cpuid.h>
+#include <string.h>
+#include <errno.h>
 
-void arch_regs_firsttimesetup(arch_regs* regs, arch_extraregs* xregs){
-	xregs->mxcsr = 0x1F80; // all exceptions masked
+// the x87/sse/avx state is switched lazily.
+// CR0.TS is set when a thread is switched in and its first fpu instruction traps
+// with #NM, which loads its state. only threads that took the trap during their
+// slice get their state saved back when they are switched out.
+
+#define XCR0_X87 1
+#define XCR0_SSE 2
+#define XCR0_AVX 4
+#define XCR0_AVX512 0xE0
+
+#define FPU_ALIGN 64
+
+static bool usexsave;
+static bool usexsaveopt;
+static uint64_t xcr0;
+static size_t fpusize;
+
+static void fpudetect(){
+	
+	if(fpusize)
+		return;
+	
+	unsigned int eax, ebx, ecx, edx;
+
+	fpusize = 512;
+
+	__cpuid(1, eax, ebx, ecx, edx);
+
+	if(!(ecx & (1 << 26)))
+		return;
+
+	__cpuid_count(0xD, 0, eax, ebx, ecx, edx);
+
+	xcr0 = eax & (XCR0_X87 | XCR0_SSE | XCR0_AVX);
+
+	if((eax & XCR0_AVX512) == XCR0_AVX512)
+		xcr0 |= XCR0_AVX512;
+	
+	// ecx covers every component the cpu supports
+	fpusize = ecx;
+	usexsave = true;
+
+	__cpuid_count(0xD, 1, eax, ebx, ecx, edx);
+	
+	usexsaveopt = eax & 1;
+
+}
+
+static inline void stts(){
+	asm volatile(
+		"mov %%cr0, %%rax;"
+		"or $8, %%rax;"
+		"mov %%rax, %%cr0;"
+		: : : "rax");
+}
+
+static inline void clts(){
+	asm volatile("clts");
+}
+
+static void fpusave(arch_extraregs* regs){
+	if(usexsaveopt)
+		asm volatile("xsaveopt64 (%0)" : : "r"(regs->fpu), "a"(0xFFFFFFFF), "d"(0xFFFFFFFF) : "memory");
+	else if(usexsave)
+		asm volatile("xsave64 (%0)" : : "r"(regs->fpu), "a"(0xFFFFFFFF), "d"(0xFFFFFFFF) : "memory");
+	else
+		asm volatile("fxsave64 (%0)" : : "r"(regs->fpu) : "memory");
+}
+
+static void fpurestore(arch_extraregs* regs){
+	if(usexsave)
+		asm volatile("xrstor64 (%0)" : : "r"(regs->fpu), "a"(0xFFFFFFFF), "d"(0xFFFFFFFF) : "memory");
+	else
+		asm volatile("fxrstor64 (%0)" : : "r"(regs->fpu) : "memory");
+}
+
+// called on every cpu
+
+void arch_regs_fpuinit(){
+	
+	fpudetect();
+
+	if(usexsave){
+		asm volatile(
+			"mov %%cr4, %%rax;"
+			"or $0x40000, %%rax;"
+			"mov %%rax, %%cr4;"
+			: : : "rax");
+		asm volatile("xsetbv" : : "c"(0), "a"((uint32_t)xcr0), "d"((uint32_t)(xcr0 >> 32)));
+	}
+
+	stts();
+
+}
+
+int arch_regs_firsttimesetup(arch_regs* regs, arch_extraregs* xregs){
+	
+	fpudetect();
+
+	xregs->fpubase = alloc(fpusize + FPU_ALIGN);
+
+	if(!xregs->fpubase)
+		return ENOMEM;
+
+	xregs->fpu = (void*)(((uintptr_t)xregs->fpubase + FPU_ALIGN - 1) & ~(uintptr_t)(FPU_ALIGN - 1));
+	memset(xregs->fpu, 0, fpusize);
+
+	*(uint16_t*)xregs->fpu = 0x37F; // fcw, all exceptions masked
+	*(uint32_t*)(xregs->fpu + 24) = 0x1F80; // mxcsr, all exceptions masked
+	
+	xregs->fpucpu = -1;
+	xregs->fpudirty = false;
+
+	return 0;
+}
+
+void arch_regs_freeextra(arch_extraregs* xregs){
+	free(xregs->fpubase);
 }
 
 void arch_regs_saveextra(arch_extraregs* regs){
 	// user gs was swapped
 	regs->gsbase = rdmsr(MSR_KERNELGSBASE);
 	regs->fsbase = rdmsr(MSR_FSBASE);	
-	asm("fxsave (%%rax)" : : "a"(&regs->fx[0]));
-	asm("stmxcsr (%%rax)" : : "a"(&regs->mxcsr));
+
+	if(regs->fpudirty){
+		fpusave(regs);
+		regs->fpudirty = false;
+	}
 }
 
 void arch_regs_setupextra(arch_extraregs* regs){
 	// gs will be swapped later
 	wrmsr(MSR_KERNELGSBASE, regs->gsbase);
 	wrmsr(MSR_FSBASE, regs->fsbase);
-	asm("fxrstor (%%rax)" : : "a"(&regs->fx[0]));
-	asm("ldmxcsr (%%rax)" : : "a"(&regs->mxcsr));
+
+	cls_t* cls = arch_getcls();
+
+	// the vdso's gettid reads tsc_aux with rdtscp
+
+	if(vdso_tidintscaux && cls->tscaux != cls->thread->tid){
+		wrmsr(MSR_TSCAUX, cls->thread->tid);
+		cls->tscaux = cls->thread->tid;
+	}
+
+	// if nothing touched the fpu here since the thread last had it, the registers still hold its state
+
+	if(cls->fpuowner == regs && regs->fpucpu == cls->cpunum){
+		clts();
+		regs->fpudirty = true;
+	}
+	else stts();
+}
+
+// #NM handler
+
+void arch_regs_fputrap(){
+	
+	cls_t* cls = arch_getcls();
+	arch_extraregs* regs = &cls->thread->extraregs;
+
+	clts();
+	fpurestore(regs);
+
+	regs->fpudirty = true;
+	regs->fpucpu = cls->cpunum;
+	cls->fpuowner = regs;
+
+}
+
+// copies the running thread's extra state, used by fork
+
+void arch_regs_copyextra(arch_extraregs* to, arch_extraregs* from){
+	
+	to->gsbase = rdmsr(MSR_KERNELGSBASE);
+	to->fsbase = rdmsr(MSR_FSBASE);
+
+	// the registers might be newer than the save area
+
+	arch_interrupt_disable();
+	
+	if(from->fpudirty)
+		fpusave(from);
+
+	arch_interrupt_enable();
+
+	memcpy(to->fpu, from->fpu, fpusize);
+
 }
 
 void arch_regs_setupkernel(arch_regs* regs, void* ip, void* stack, bool interrupts){
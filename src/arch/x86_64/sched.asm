@@ -5,6 +5,7 @@ global arch_sched_yieldtrampoline
 ; C sysv abi
 ; rdi -> thread ptr
 ; rsi -> regs ptr
+; rdx -> stack to continue on
 
 REGSTRUCTSIZE equ 208
 
@@ -56,9 +57,10 @@ arch_sched_yieldtrampoline:
 	mov r10, cr2
 	push r10
 
-	; restore old stack pointer
+	; move to the scheduler stack, the thread's own stack can't be used anymore
+	; after it gets queued as another cpu might pick it up
 
-	mov rsp, r11
+	mov rsp, rdx
 	
 	extern sched_yieldtrampoline
 	call sched_yieldtrampoline
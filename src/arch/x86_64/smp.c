@@ -9,17 +9,21 @@
 #include <arch/idt.h>
 #include <arch/mmu.h>
 #include <arch/apic.h>
+#include <arch/timekeeper.h>
 #include <kernel/pmm.h>
 #include <kernel/semaphore.h>
+#include <kernel/sched.h>
 
 static cls_t* apcls;
+static cls_t** clslist;
 static semaphore_t* sem;
 
 static size_t cpucount = 0;
 
 static void apstartup(struct limine_smp_info *info){
 	
-	arch_setcls(&apcls[info->processor_id]);
+	arch_setcls(&apcls[info->extra_argument]);
+	arch_getcls()->cpunum = info->extra_argument;
 
 	gdt_init();
 
@@ -27,14 +31,18 @@ static void apstartup(struct limine_smp_info *info){
 
 	arch_mmu_apinit();
 	apic_lapicinit();
+	arch_timekeeper_apinit();
 	timer_init();
 	cpu_state_init();
+	sched_apinit();
 
 	printf("CPU %lu ready!\n", info->lapic_id);
 
 	sem_signal(sem);
 	
-	for(;;) asm("hlt");
+	// from here on this context is the cpu's idle thread
+
+	sched_idle();
 
 }
 
@@ -42,10 +50,25 @@ size_t arch_smp_cpucount(){
 	return cpucount;
 }
 
+cls_t* arch_smp_getcls(size_t cpu){
+	return clslist[cpu];
+}
+
 void arch_smp_sendipi(int processor, int vector, int mode){
 	apic_sendipi(processor, vector, mode, 0, 1);
 }
 
+void arch_smp_resched(cls_t* cpu){
+	arch_smp_sendipi(cpu->lapicid, VECTOR_RESCHED, IPI_CPU_TARGET);
+}
+
+// the idle flag was already cleared by the caller, which is enough for a cpu in mwait
+
+void arch_smp_wakeidle(cls_t* cpu){
+	if(!cpu->mwait)
+		arch_smp_resched(cpu);
+}
+
 static volatile struct limine_smp_request smpreq = {
 	.id = LIMINE_SMP_REQUEST,
 	.revision = 0
@@ -62,14 +85,30 @@ void smp_init(){
 	struct limine_smp_info** cpus = r->cpus;
 	
 	apcls = alloc(sizeof(cls_t)*cpucount);
+	clslist = alloc(sizeof(cls_t*)*cpucount);
+
+	if(!apcls || !clslist)
+		_panic("Out of memory", 0);
 
 	printf("System has %lu CPUs\n", cpucount);
 	
 	sem = sem_init(-cpucount + 2, 0);
 
+	// the bsp is always cpu 0 and the aps are numbered in the order limine lists them.
+	// the list has to be complete before any cpu can start scheduling
+
+	clslist[0] = arch_getcls();
+
+	for(size_t i = 0, n = 1; i < cpucount; ++i){
+		if(cpus[i]->lapic_id == r->bsp_lapic_id) continue;
+		cpus[i]->extra_argument = n;
+		clslist[n] = &apcls[n];
+		++n;
+	}
+
 	for(size_t i = 0; i < cpucount; ++i){
 		if(cpus[i]->lapic_id == r->bsp_lapic_id) continue;
-		printf("Dispatching CPU %lu\n", i);	
+		printf("Dispatching CPU %lu\n", cpus[i]->extra_argument);	
 		asm volatile(".intel_syntax noprefix;"
 			"lock xchg rax, [rbx];"
 			".att_syntax prefix;"
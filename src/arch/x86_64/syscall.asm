@@ -47,7 +47,17 @@ extern syscall_recvmsg
 extern syscall_futex
 extern syscall_newthread
 extern syscall_threadexit
-func_count equ 46
+extern syscall_setpriority
+extern syscall_getpriority
+extern syscall_sched_setaffinity
+extern syscall_sched_getaffinity
+extern syscall_epoll_create1
+extern syscall_epoll_ctl
+extern syscall_epoll_wait
+extern syscall_sched_setscheduler
+extern syscall_sched_getscheduler
+extern syscall_sched_getparam
+func_count equ 56
 
 
 func_table:
@@ -97,6 +107,16 @@ func_table:
 	dq syscall_futex
 	dq syscall_newthread
 	dq syscall_threadexit
+	dq syscall_setpriority
+	dq syscall_getpriority
+	dq syscall_sched_setaffinity
+	dq syscall_sched_getaffinity
+	dq syscall_epoll_create1
+	dq syscall_epoll_ctl
+	dq syscall_epoll_wait
+	dq syscall_sched_setscheduler
+	dq syscall_sched_getscheduler
+	dq syscall_sched_getparam
 section .text
 global asm_syscall_entry
 
@@ -51,7 +51,17 @@ static char* syscalls[] = {
 	"syscall_recvmsg",
 	"syscall_futex",
 	"syscall_newthread",
-	"syscall_threadexit"
+	"syscall_threadexit",
+	"syscall_setpriority",
+	"syscall_getpriority",
+	"syscall_sched_setaffinity",
+	"syscall_sched_getaffinity",
+	"syscall_epoll_create1",
+	"syscall_epoll_ctl",
+	"syscall_epoll_wait",
+	"syscall_sched_setscheduler",
+	"syscall_sched_getscheduler",
+	"syscall_sched_getparam"
 	
 };
 
@@ -2,23 +2,149 @@
 #include <limine.h>
 #include <arch/panic.h>
 #include <arch/hpet.h>
+#include <arch/tsc.h>
+#include <arch/cls.h>
+#include <arch/interrupt.h>
+#include <arch/vdso.h>
+#include <kernel/env.h>
+#include <stdio.h>
+
+// time from boot comes from a clocksource, a free running counter and a fixed
+// point factor that turns counter ticks into ns. an invariant tsc is timed
+// against the hpet at boot and used from then on, as reading it is a single
+// instruction instead of an mmio read. the hpet is only read directly when the
+// tsc can't be trusted or "notsc" is set
+
+#define SHIFT 32
+
+// how long the tsc is timed against the hpet for
+#define CALIBRATION_MS 50
+
+// smaller differences between a cpu's tsc and the bsp's are left alone
+#define MAXSKEWNS 1000
+
+#define SAMPLES 5
+
+typedef struct{
+	const char* name;
+	uint64_t (*read)();
+	uint64_t base;
+	uint64_t mult;
+} clocksource;
 
 static time_t bootunixtime;
-static time_t timerticksperus;
-static time_t timerusatboot;
 
 static volatile struct limine_boot_time_request lim_boottime = {
 	.id = LIMINE_BOOT_TIME_REQUEST,
 	.revision = 0,
 };
 
+// set once a cpu needs its own tsc offset
+static bool tscoffsets;
+
+static uint64_t hpetread(){
+	return hpet_get_counter();
+}
+
+static uint64_t tscread(){
+
+	if(!tscoffsets)
+		return rdtsc();
+
+	// the offset has to be from the cpu the tsc was read on
+
+	bool intstate = arch_interrupt_save();
+	uint64_t tsc = rdtsc() - arch_getcls()->tscoffset;
+	arch_interrupt_restore(intstate);
+
+	return tsc;
+
+}
+
+static clocksource hpetsource = {
+	.name = "hpet",
+	.read = hpetread
+};
+
+static clocksource tscsource = {
+	.name = "tsc",
+	.read = tscread
+};
+
+static clocksource* source = &hpetsource;
+
+// tsc ticks per ns in the same fixed point format, used for the offsets
+static uint64_t tscperns;
+static size_t tscperus;
+
+static inline uint64_t scale(uint64_t ticks, uint64_t mult){
+	return ((unsigned __int128)ticks * mult) >> SHIFT;
+}
+
+// reads the hpet and the tsc at the same moment. the hpet read is timed with
+// the tsc and the quickest of a few tries is used, the return value is how far
+// off the tsc can be
+
+static uint64_t sample(uint64_t* hpet, uint64_t* tsc){
+
+	uint64_t best = ~0ul;
+
+	for(int i = 0; i < SAMPLES; ++i){
+		uint64_t start = rdtsc();
+		uint64_t counter = hpet_get_counter();
+		uint64_t end = rdtsc();
+
+		if(end - start < best){
+			best = end - start;
+			*hpet = counter;
+			*tsc = start + best / 2;
+		}
+	}
+
+	return best / 2;
+
+}
+
+static bool tsccalibrate(){
+
+	if(!tsc_invariant())
+		return false;
+
+	uint64_t hpetstart, tscstart, hpetend, tscend;
+
+	sample(&hpetstart, &tscstart);
+	hpet_wait_ms(CALIBRATION_MS);
+	sample(&hpetend, &tscend);
+
+	uint64_t ns = (hpetend - hpetstart) * hpet_get_period() / 1000000;
+	uint64_t ticks = tscend - tscstart;
+
+	if(ns == 0 || ticks == 0)
+		return false;
+
+	// both count from the same moment
+
+	hpetsource.base = hpetstart;
+	tscsource.base = tscstart;
+	tscsource.mult = (ns << SHIFT) / ticks;
+	tscperns = (ticks << SHIFT) / ns;
+	tscperus = ticks * 1000 / ns;
+
+	return true;
+
+}
+
+uint64_t arch_timekeeper_nsfromboot(){
+	return scale(source->read() - source->base, source->mult);
+}
+
 struct timespec arch_timekeeper_gettimefromboot(){
 	struct timespec time;
 
-	time_t timercurrentus = hpet_get_counter() / timerticksperus - timerusatboot;
+	uint64_t ns = arch_timekeeper_nsfromboot();
 
-	time.tv_sec = timercurrentus / US_IN_SECS;
-	time.tv_nsec = (timercurrentus % US_IN_SECS) * NS_IN_US;
+	time.tv_sec = ns / 1000000000;
+	time.tv_nsec = ns % 1000000000;
 
 	return time;
 
@@ -34,14 +160,59 @@ struct timespec arch_timekeeper_gettime(){
 
 }
 
+const char* arch_timekeeper_source(){
+	return source->name;
+}
+
+// 0 if the tsc wasn't calibrated
+
+size_t arch_timekeeper_tscperus(){
+	return tscperus;
+}
+
+// an ap's tsc can be off from the bsp's if the firmware didn't sync them.
+// the hpet is shared so it is used to see where the tsc should be
+
+void arch_timekeeper_apinit(){
+
+	if(source != &tscsource)
+		return;
+
+	uint64_t hpet, tsc;
+	uint64_t error = sample(&hpet, &tsc);
+
+	uint64_t ns = scale(hpet - hpetsource.base, hpetsource.mult);
+	int64_t offset = tsc - (tscsource.base + scale(ns, tscperns));
+	uint64_t skew = offset < 0 ? -offset : offset;
+
+	if(skew <= error + MAXSKEWNS * tscperus / 1000)
+		return;
+
+	arch_getcls()->tscoffset = offset;
+	__atomic_store_n(&tscoffsets, true, __ATOMIC_RELEASE);
+	arch_vdso_settime(VDSO_CLOCK_SYSCALL, tscsource.base, tscsource.mult, bootunixtime);
+
+	printf("timekeeper: cpu %lu tsc is off by %ld ticks\n", arch_getcls()->cpunum, offset);
+
+}
+
 void arch_timekeeper_init(){
-	
+
 	if(!lim_boottime.response)
 		_panic("No limine boot time response\n", 0);
-	
+
 	bootunixtime = lim_boottime.response->boot_time;
 
-	timerticksperus  = hpet_get_ticksperus();
-	
-	timerusatboot = hpet_get_counter() / timerticksperus;
+	hpetsource.base = hpet_get_counter();
+	hpetsource.mult = (hpet_get_period() << SHIFT) / 1000000;
+
+	if(tsccalibrate() && !env_isset("notsc"))
+		source = &tscsource;
+
+	// the vdso can only use the tsc while every cpu reads the same value
+
+	arch_vdso_settime(source == &tscsource ? VDSO_CLOCK_TSC : VDSO_CLOCK_SYSCALL, tscsource.base, tscsource.mult, bootunixtime);
+
+	printf("timekeeper: using %s\n", source->name);
+
 }
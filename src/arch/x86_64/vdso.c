@@ -0,0 +1,114 @@
+#include <arch/vdso.h>
+#include <arch/tsc.h>
+#include <arch/cls.h>
+#include <arch/mmu.h>
+#include <arch/spinlock.h>
+#include <arch/panic.h>
+#include <kernel/pmm.h>
+#include <string.h>
+#include <errno.h>
+#include <stdio.h>
+
+// the vdso lets processes read the clock and their ids without a syscall.
+// the image is built on its own in vdso/ and included by vdsoimage.asm,
+// it finds the time and process pages at fixed offsets below itself
+
+extern uint8_t vdso_image_start[];
+extern uint8_t vdso_image_end[];
+
+// physical addresses
+static void* timepage;
+static void* imagepages;
+static size_t imagepagec;
+
+static int timelock;
+
+bool vdso_tidintscaux;
+
+static inline vdso_timedata* timedata(){
+	return MAKEHHDM(timepage);
+}
+
+// the process page is read only for the process, so it is written through the hhdm
+
+static void setproc(vmm_context* ctx, proc_t* proc){
+	vdso_procdata* data = MAKEHHDM(arch_mmu_getphysicaladdr(ctx->context, (void*)VDSO_PROCPAGE));
+	data->pid = proc->pid;
+}
+
+void arch_vdso_init(){
+
+	size_t size = vdso_image_end - vdso_image_start;
+	imagepagec = (size + PAGE_SIZE - 1) / PAGE_SIZE;
+
+	timepage = pmm_alloc(1);
+	imagepages = pmm_alloc(imagepagec);
+
+	if(!timepage || !imagepages)
+		_panic("Out of memory for the vdso\n", 0);
+
+	memset(MAKEHHDM(timepage), 0, PAGE_SIZE);
+	memset(MAKEHHDM(imagepages), 0, imagepagec*PAGE_SIZE);
+	memcpy(MAKEHHDM(imagepages), vdso_image_start, size);
+
+	// rdtscp returns tsc_aux, which gets the thread id on every switch
+
+	vdso_tidintscaux = tsc_rdtscpsupported();
+	timedata()->tidintscaux = vdso_tidintscaux;
+
+	printf("vdso: %lu byte image\n", size);
+
+}
+
+// readers retry while seq is odd or changed under them
+
+void arch_vdso_settime(uint32_t clockmode, uint64_t tscbase, uint64_t tscmult, int64_t bootunixtime){
+
+	vdso_timedata* data = timedata();
+
+	spinlock_acquire(&timelock);
+
+	__atomic_store_n(&data->seq, data->seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	data->clockmode = clockmode;
+	data->tscbase = tscbase;
+	data->tscmult = tscmult;
+	data->bootunixtime = bootunixtime;
+
+	__atomic_store_n(&data->seq, data->seq + 1, __ATOMIC_RELEASE);
+
+	spinlock_release(&timelock);
+
+}
+
+// maps the vdso into the current address space, returns the address of the image
+
+int arch_vdso_map(proc_t* proc, uint64_t* ehdr){
+
+	if(!vmm_mapshared(timepage, (void*)VDSO_TIMEPAGE, 1, ARCH_MMU_MAP_READ | ARCH_MMU_MAP_USER | ARCH_MMU_MAP_NOEXEC))
+		return ENOMEM;
+
+	if(!vmm_allocnowat((void*)VDSO_PROCPAGE, ARCH_MMU_MAP_READ | ARCH_MMU_MAP_USER | ARCH_MMU_MAP_NOEXEC, PAGE_SIZE))
+		return ENOMEM;
+
+	vmm_context* ctx = arch_getcls()->context;
+
+	memset(MAKEHHDM(arch_mmu_getphysicaladdr(ctx->context, (void*)VDSO_PROCPAGE)), 0, PAGE_SIZE);
+	setproc(ctx, proc);
+
+	if(!vmm_mapshared(imagepages, (void*)VDSO_IMAGE, imagepagec, ARCH_MMU_MAP_READ | ARCH_MMU_MAP_USER))
+		return ENOMEM;
+
+	*ehdr = VDSO_IMAGE;
+
+	return 0;
+
+}
+
+// the child got a copy of the parent's process page
+
+void arch_vdso_fork(vmm_context* ctx, proc_t* proc){
+	if(arch_mmu_ismapped(ctx->context, (void*)VDSO_PROCPAGE))
+		setproc(ctx, proc);
+}
@@ -0,0 +1,94 @@
+#include <arch/vdso.h>
+#include <time.h>
+
+// runs in user space, position independent and without a libc.
+// the functions return an errno like the syscalls they stand in for
+
+#define EXPORT __attribute__((visibility("default")))
+
+#define CLOCK_REALTIME 0
+#define CLOCK_MONOTONIC 1
+
+#define SYSCALL_GETTID 3
+#define SYSCALL_GETPID 19
+#define SYSCALL_CLOCK_GETTIME 33
+
+// placed below the image by vdso.ld
+extern volatile vdso_timedata vdso_timepage;
+extern volatile vdso_procdata vdso_procpage;
+
+static inline long syscall2(long func, long arg1, long arg2, long* ret){
+	long errno;
+	asm volatile("syscall" : "=a"(*ret), "=d"(errno) : "a"(func), "D"(arg1), "S"(arg2) : "rcx", "r11", "memory");
+	return errno;
+}
+
+// the read can't be done before the seq count is
+
+static inline uint64_t rdtsc(){
+	uint32_t low, high;
+	asm volatile("lfence; rdtsc" : "=a"(low), "=d"(high));
+	return ((uint64_t)high << 32) | low;
+}
+
+EXPORT int __vdso_clock_gettime(int clockid, struct timespec* tp){
+
+	long ret;
+
+	if(clockid != CLOCK_REALTIME && clockid != CLOCK_MONOTONIC)
+		return syscall2(SYSCALL_CLOCK_GETTIME, clockid, (long)tp, &ret);
+
+	uint64_t ns;
+	int64_t boot;
+
+	for(;;){
+		uint32_t seq = __atomic_load_n(&vdso_timepage.seq, __ATOMIC_ACQUIRE);
+
+		if(seq & 1){
+			asm volatile("pause");
+			continue;
+		}
+
+		if(vdso_timepage.clockmode != VDSO_CLOCK_TSC)
+			return syscall2(SYSCALL_CLOCK_GETTIME, clockid, (long)tp, &ret);
+
+		// same math as the kernel's tsc clocksource
+
+		ns = ((unsigned __int128)(rdtsc() - vdso_timepage.tscbase) * vdso_timepage.tscmult) >> 32;
+		boot = vdso_timepage.bootunixtime;
+
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+		if(__atomic_load_n(&vdso_timepage.seq, __ATOMIC_RELAXED) == seq)
+			break;
+	}
+
+	tp->tv_sec = ns / 1000000000;
+	tp->tv_nsec = ns % 1000000000;
+
+	if(clockid == CLOCK_REALTIME)
+		tp->tv_sec += boot;
+
+	return 0;
+
+}
+
+EXPORT int __vdso_getpid(){
+	return vdso_procpage.pid;
+}
+
+EXPORT int __vdso_gettid(){
+
+	long ret;
+
+	if(!vdso_timepage.tidintscaux){
+		syscall2(SYSCALL_GETTID, 0, 0, &ret);
+		return ret;
+	}
+
+	uint32_t low, high, aux;
+	asm volatile("rdtscp" : "=a"(low), "=d"(high), "=c"(aux));
+
+	return aux;
+
+}
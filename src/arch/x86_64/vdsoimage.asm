@@ -0,0 +1,10 @@
+section .rodata
+
+; built in vdso/ before this is assembled
+
+global vdso_image_start
+global vdso_image_end
+
+vdso_image_start:
+incbin "vdso/vdso.so"
+vdso_image_end:
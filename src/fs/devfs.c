@@ -2,12 +2,16 @@
 #include <kernel/vfs.h>
 #include <kernel/alloc.h>
 #include <hashtable.h>
+#include <arch/spinlock.h>
 
 #include <sys/sysmacros.h>
 
 static hashtable devnodes;
 static fs_t* fs;
 
+// taken to add devices and to list them, lookups go without it
+static ticketlock_t devlock;
+
 static int devfs_mount(dirnode_t* mountpoint, vnode_t* device, int mountflags, void* fsinfo){
 	
 	dirnode_t* node = vfs_newdirnode(mountpoint->vnode.name, fs, NULL, mountpoint->vnode.parent);
@@ -15,7 +19,7 @@ static int devfs_mount(dirnode_t* mountpoint, vnode_t* device, int mountflags, v
 	if(!node)
 		return ENOMEM;
 	
-	mountpoint->mount = node;
+	__atomic_store_n(&mountpoint->mount, node, __ATOMIC_RELEASE);
 	
 	return 0;
 }
@@ -33,13 +37,13 @@ static int devfs_open(dirnode_t* parent, char* name){
 	if(!node)
 		return ENOMEM;
 
+	node->st = devnode->st;
+
 	if(!hashtable_insert(&parent->children, name, node)){
 		vfs_destroynode(node);
 		return ENOMEM;
 	}
 
-	node->st = devnode->st;
-
 	return 0;
 
 }
@@ -52,12 +56,18 @@ static int devfs_getdirent(dirnode_t* node, dent_t* buff, size_t count, uintmax_
 
 	// all getdirents on devfs will return the same
 
+	ticketlock_acquire(&devlock);
+
+	hashtableiter iter;
+	hashtable_iterstart(&devnodes, &iter, offset);
+
         for(uintmax_t i = 0; i < count; ++i){
                 dent_t* d = &buff[i];
-                vnode_t* child = hashtable_fromoffset(&devnodes, offset, d->d_name);
+                vnode_t* child = hashtable_iternext(&devnodes, &iter, d->d_name);
                 
 		if(!child){
                         *readcount = i;
+			ticketlock_release(&devlock);
                         return 0;
                 }
 
@@ -70,6 +80,8 @@ static int devfs_getdirent(dirnode_t* node, dent_t* buff, size_t count, uintmax_
 
         *readcount = count;
 
+	ticketlock_release(&devlock);
+
         return 0;
 }
 
@@ -94,23 +106,33 @@ void devfs_init(){
 
 int devfs_newdevice(char* name, int type, dev_t dev, mode_t mode){
 	
-	if(hashtable_get(&devnodes, name))
+	ticketlock_acquire(&devlock);
+
+	if(hashtable_get(&devnodes, name)){
+		ticketlock_release(&devlock);
 		return EEXIST;
+	}
 
 	vnode_t* node = vfs_newnode(name, fs, 0);
-	if(!node)
-		return ENOMEM;
-	
-	if(!hashtable_insert(&devnodes, name, node)){
-		vfs_destroynode(node);
+	if(!node){
+		ticketlock_release(&devlock);
 		return ENOMEM;
 	}
 
 	node->st.st_rdev = dev;
 	node->st.st_mode = MAKETYPE(type) | mode;
 	node->st.st_ino  = fs->data;
+	
+	int err = 0;
 
-	return 0;
+	if(!hashtable_insert(&devnodes, name, node)){
+		vfs_destroynode(node);
+		err = ENOMEM;
+	}
+
+	ticketlock_release(&devlock);
+
+	return err;
 	
 }
 
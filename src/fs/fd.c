@@ -2,9 +2,16 @@
 #include <arch/spinlock.h>
 #include <stdbool.h>
 #include <kernel/alloc.h>
+#include <kernel/slab.h>
 #include <string.h>
 #include <kernel/pipe.h>
 
+static slab_cache fdcache;
+
+void fd_init(){
+	slab_cacheinit(&fdcache, sizeof(fd_t), NULL);
+}
+
 int fd_release(fd_t* fd){	
 	spinlock_release(&fd->lock);
 	return 0;
@@ -70,7 +77,7 @@ int fd_alloc(fdtable_t* fdtable, fd_t** fd, int* ifd, int lowest){
 		
 	}
 	
-	fd_t* tmp = alloc(sizeof(fd_t));
+	fd_t* tmp = slab_cachealloc(&fdcache);
 	
 	if(!tmp){
 		spinlock_release(&fdtable->lock);
@@ -134,7 +141,7 @@ int fd_free(fdtable_t* fdtable, int ifd){
 	if(fd->node)
 		err = vfs_close(fd->node);
 	
-	free(fd);
+	slab_cachefree(&fdcache, fd);
 
 	return err;
 	
@@ -251,7 +258,7 @@ int fd_duplicate(fdtable_t* table, int src, int dest, int type, int* ret){
 			spinlock_acquire(&destfd->lock);
 			if(__atomic_sub_fetch(&destfd->refcount, 1, __ATOMIC_RELAXED) == 0){
 				if(destfd->node) vfs_close(destfd->node);
-				free(destfd);
+				slab_cachefree(&fdcache, destfd);
 			}
 			else{
 				spinlock_release(&destfd->lock);
@@ -23,8 +23,8 @@ static int tmpfs_mount(dirnode_t* mountpoint, vnode_t* device, int mountflags, v
 	}
 
 	desc->calls = tmpfs_getfuncs();
-	mountpoint->mount = root;
 	root->vnode.st.st_mode = MAKETYPE(TYPE_DIR) | 0777;
+	__atomic_store_n(&mountpoint->mount, root, __ATOMIC_RELEASE);
 
 	return 0;
 }
@@ -35,16 +35,19 @@ static int tmpfs_write(int* error, vnode_t* node, void* buff, size_t count, size
 
 	size_t targetpage = (count + offset) / PAGE_SIZE;
 
+	// the buffer at least doubles, so writing a file in pieces doesn't copy it every time
+
 	if(node->st.st_blocks <= targetpage){
-		void* new = pmm_hhdmalloc(targetpage+1);
+		size_t blocks = node->st.st_blocks * 2 > targetpage + 1 ? node->st.st_blocks * 2 : targetpage + 1;
+		void* new = pmm_hhdmalloc(blocks);
 		if(!new){
 			*error = ENOMEM;
 			return -1;
 		};
 		memcpy(new, node->fsdata, node->st.st_size);
-		pmm_free(node->fsdata, node->st.st_size / PAGE_SIZE + 1);
+		pmm_hhdmfree(node->fsdata, node->st.st_blocks);
 		node->fsdata = new;
-		node->st.st_blocks = targetpage+1;
+		node->st.st_blocks = blocks;
 		node->st.st_size = count + offset;
 	}
 
@@ -75,47 +78,48 @@ static int tmpfs_unmount(fs_t* fs) UNIMPLEMENTED
 static int tmpfs_open(dirnode_t* parent, char* name){ return ENOENT;} // tmpfs open should never be called if a file exists
 static int tmpfs_close(vnode_t* node){return 0;} // nothing to do really
 
+// path walks don't take the parent's lock, so nodes are filled in
+// before they are put in it
+
+static size_t newino(dirnode_t* parent){
+	return (size_t)__atomic_fetch_add(&parent->vnode.fs->data, 1, __ATOMIC_RELAXED);
+}
+
 static int tmpfs_mkdir(dirnode_t* parent, char* name, mode_t mode){
 	
 	dirnode_t* node = vfs_newdirnode(name, parent->vnode.fs, NULL, parent);
 	
 	if(!node) 
 		return ENOMEM;
-
-	if(!hashtable_insert(&parent->children, name, node)){
-		vfs_destroynode(node);
-		return ENOMEM;
-	}
 	
 	stat* st = &node->vnode.st;
 	
 	st->st_mode = MAKETYPE(TYPE_DIR) | mode;
 	st->st_blksize = PAGE_SIZE;
-	st->st_ino = parent->vnode.fs->data++;
+	st->st_ino = newino(parent);
+
+	if(!hashtable_insert(&parent->children, name, node)){
+		vfs_destroynode(node);
+		return ENOMEM;
+	}
 
 	return 0;
 	
 }
 
-static int tmpfs_create(dirnode_t* parent, char* name, mode_t mode){
+static vnode_t* newfile(dirnode_t* parent, char* name, mode_t mode){
 		
 	// TODO use virtual memory
 	void* firstpage = pmm_hhdmalloc(1);
 
 	if(!firstpage)
-		return ENOMEM;
+		return NULL;
 
 	vnode_t* node = vfs_newnode(name, parent->vnode.fs, NULL);
 
 	if(!node){
-		pmm_free(firstpage, 1);
-		return ENOMEM;
-	}
-	
-	if(!hashtable_insert(&parent->children, name, node)){
-		pmm_free(firstpage, 1);
-		vfs_destroynode(node);
-		return ENOMEM;
+		pmm_hhdmfree(firstpage, 1);
+		return NULL;
 	}
 	
 	node->parent = parent;
@@ -123,21 +127,44 @@ static int tmpfs_create(dirnode_t* parent, char* name, mode_t mode){
 	stat* st = &node->st;
 	st->st_blksize = PAGE_SIZE;
 	st->st_blocks = 1;
-	st->st_mode = MAKETYPE(TYPE_REGULAR) | mode;
+	st->st_mode = mode;
 	st->st_nlink = 1;
-	st->st_ino = parent->vnode.fs->data++;
+	st->st_ino = newino(parent);
+
+	return node;
+}
+
+static int insertfile(dirnode_t* parent, char* name, vnode_t* node){
 	
+	if(!hashtable_insert(&parent->children, name, node)){
+		pmm_hhdmfree(node->fsdata, node->st.st_blocks);
+		vfs_destroynode(node);
+		return ENOMEM;
+	}
 
 	return 0;
 }
 
+static int tmpfs_create(dirnode_t* parent, char* name, mode_t mode){
+	
+	vnode_t* node = newfile(parent, name, MAKETYPE(TYPE_REGULAR) | mode);
+
+	if(!node)
+		return ENOMEM;
+
+	return insertfile(parent, name, node);
+}
+
 static int tmpfs_getdirent(dirnode_t* node, dent_t* buff, size_t count, uintmax_t offset, size_t* readcount){
 
 	*readcount = 0;
 
+	hashtableiter iter;
+	hashtable_iterstart(&node->children, &iter, offset);
+
 	for(uintmax_t i = 0; i < count; ++i){
 		dent_t* d = &buff[i];
-		vnode_t* child = hashtable_fromoffset(&node->children, offset, d->d_name);
+		vnode_t* child = hashtable_iternext(&node->children, &iter, d->d_name);
 		if(!child){
 			*readcount = i;
 			return 0;
@@ -167,35 +194,34 @@ static int tmpfs_mksocket(dirnode_t* parent, char* name, mode_t mode){
 	
 	if(!node) 
 		return ENOMEM;
-
-	if(!hashtable_insert(&parent->children, name, node)){
-		vfs_destroynode(node);
-		return ENOMEM;
-	}
 	
 	stat* st = &node->st;
 	
 	st->st_mode = MAKETYPE(TYPE_SOCKET) | mode;
 	st->st_blksize = PAGE_SIZE;
-	st->st_ino = parent->vnode.fs->data++;
+	st->st_ino = newino(parent);
+
+	if(!hashtable_insert(&parent->children, name, node)){
+		vfs_destroynode(node);
+		return ENOMEM;
+	}
 
 	return 0;
 	
 }
 
 static int tmpfs_symlink(dirnode_t* parent, char* name, char* target, mode_t mode){
-	int error = tmpfs_create(parent, name, mode);
 	
-	if(error)
-		return error;
-
-	vnode_t* node = hashtable_get(&parent->children, name);
+	vnode_t* node = newfile(parent, name, MAKETYPE(TYPE_LINK) | mode);
+	
+	if(!node)
+		return ENOMEM;
 
-	node->st.st_mode = MAKETYPE(TYPE_LINK) | mode;
+	int error;
 
 	tmpfs_write(&error, node, target, strlen(target)+1, 0);
 
-	return 0;
+	return insertfile(parent, name, node);
 
 }
 
@@ -225,7 +251,7 @@ static int tmpfs_link(dirnode_t* parent, vnode_t* link, char* name){
 	if(!hashtable_insert(&parent->children, name, link))
 		return ENOMEM;
 
-	++link->st.st_nlink;
+	__atomic_add_fetch(&link->st.st_nlink, 1, __ATOMIC_RELAXED);
 
 	return 0;
 
@@ -10,17 +10,29 @@
 #include <arch/timekeeper.h>
 #include <arch/cls.h>
 #include <kernel/fd.h>
+#include <kernel/epoll.h>
 
 #define VFS_MAX_LOOP 5
 
+// file data is copied in pieces of this size, so a big read or write doesn't
+// keep the node lock (and preemption) off for its whole length
+#define VFS_CHUNK (64*1024)
+
 dirnode_t* vfsroot;
 hashtable  fsfuncs;
-static int lock;
+
+// paths are walked without a lock. a folder's own lock is held while
+// something is added to it and a node's lock while its data is used,
+// this one is only left for mounts, closes and maps
+static ticketlock_t lock;
+
+// the mounted root is filled in before it is published
 
 static inline dirnode_t* mountpoint(dirnode_t* node){
 	dirnode_t* ret = node;
-	while(ret->mount)
-		ret = ret->mount;
+	dirnode_t* mount;
+	while((mount = __atomic_load_n(&ret->mount, __ATOMIC_ACQUIRE)))
+		ret = mount;
 	return ret;
 }
 
@@ -35,31 +47,24 @@ void vfs_debugdumptree(dirnode_t* node, size_t depth, size_t maxdepth){
 	
 	node = mountpoint(node);
 
-	for(size_t i = 0; i < node->children.size; ++i){
-		hashtableentry* entry = &node->children.entries[i];
+	hashtableiter iter;
+	char name[512];
+	vnode_t* chnode;
+
+	hashtable_iterstart(&node->children, &iter, 0);
+
+	while(hashtable_iternext(&node->children, &iter, name))
+		printf("%s ", name);
 
-		while(entry && entry->key){
-			printf("%s ", entry->key);
-			entry = entry->next;
-		}
-		
-	}
 	// now recurse into directories
 	
 	printf("\n");
 
-	for(size_t i = 0; i < node->children.size; ++i){
-		hashtableentry* entry = &node->children.entries[i];
-		
-		while(entry && entry->val){
-			vnode_t* chnode = entry->val;
-			
-			if(GETTYPE(chnode->st.st_mode) == TYPE_DIR)
-				vfs_debugdumptree((dirnode_t*)chnode, depth + 1, maxdepth);
-			entry = entry->next;
-		}
+	hashtable_iterstart(&node->children, &iter, 0);
 
-		
+	while((chnode = hashtable_iternext(&node->children, &iter, name))){
+		if(GETTYPE(chnode->st.st_mode) == TYPE_DIR && strcmp(name, ".") && strcmp(name, ".."))
+			vfs_debugdumptree((dirnode_t*)chnode, depth + 1, maxdepth);
 	}
 
 
@@ -77,7 +82,7 @@ int vfs_write(int* error, vnode_t* node, void* buff, size_t count, size_t offset
 		return pipe_write(node->objdata, buff, count, error);
 	
 
-	if(type == TYPE_DIR || type == TYPE_LINK){
+	if(type == TYPE_DIR || type == TYPE_LINK || type == TYPE_EPOLL){
 		*error = EINVAL;
 		return -1;
 	}
@@ -91,11 +96,32 @@ int vfs_write(int* error, vnode_t* node, void* buff, size_t count, size_t offset
 	if(!node->fs->calls->write)
 		return ENOSYS;
 	
-	spinlock_acquire(&lock);
+	ticketlock_acquire(&node->lock);
 	
-	int writecount = node->fs->calls->write(error, node, buff, count, offset);
+	int writecount = 0;
+	*error = 0;
+
+	while(writecount < count){
+		
+		size_t size = count - writecount > VFS_CHUNK ? VFS_CHUNK : count - writecount;
+		int ret = node->fs->calls->write(error, node, buff + writecount, size, offset + writecount);
+
+		if(ret == -1){
+			if(writecount == 0)
+				writecount = -1;
+			break;
+		}
+
+		writecount += ret;
+
+		if(ret < size)
+			break;
+
+		ticketlock_break(&node->lock);
+
+	}
 	
-	spinlock_release(&lock);
+	ticketlock_release(&node->lock);
 
 	return writecount;
 	
@@ -115,26 +141,28 @@ int vfs_chmod(vnode_t* node, mode_t mode){
 	if(!node->fs->calls->chmod)
 		return ENOSYS;
 
-	spinlock_acquire(&lock);
+	ticketlock_acquire(&node->lock);
 
 	int ret = node->fs->calls->chmod(node, mode);
 
-	spinlock_release(&lock);
+	ticketlock_release(&node->lock);
 
 	return ret;
 
 }
 
-int vfs_poll(vnode_t* node, pollfd* fd){
+int vfs_poll(vnode_t* node, pollfd* fd, poll_table* table){
 	
 	switch(GETTYPE(node->st.st_mode)){
 		case TYPE_CHARDEV:
 		case TYPE_BLOCKDEV:
-			return devman_poll(node->st.st_rdev, fd);
+			return devman_poll(node->st.st_rdev, fd, table);
 		case TYPE_FIFO:
-			return pipe_poll(node->objdata, fd);
+			return pipe_poll(node->objdata, fd, table);
 		case TYPE_SOCKET:
-			return socket_poll(node->objdata, fd);
+			return socket_poll(node->objdata, fd, table);
+		case TYPE_EPOLL:
+			return epoll_poll(node->objdata, fd, table);
 		default:
 			printf("Tried to poll an object of type %lu\n", GETTYPE(node->st.st_mode));
 			_panic("Unsupported poll", NULL);	
@@ -167,7 +195,7 @@ int vfs_read(int* error, vnode_t* node, void* buff, size_t count, size_t offset,
 		return pipe_read(node->objdata, buff, count, error);
 	}
 
-	if(type == TYPE_DIR || type == TYPE_LINK){
+	if(type == TYPE_DIR || type == TYPE_LINK || type == TYPE_EPOLL){
 		*error = EINVAL;
 		return -1;
 	}
@@ -180,11 +208,32 @@ int vfs_read(int* error, vnode_t* node, void* buff, size_t count, size_t offset,
 	if(!node->fs->calls->read)
 		return ENOSYS;
 	
-	spinlock_acquire(&lock);
+	ticketlock_acquire(&node->lock);
 	
-	int readcount = node->fs->calls->read(error, node, buff, count, offset);
+	int readcount = 0;
+	*error = 0;
+
+	while(readcount < count){
+		
+		size_t size = count - readcount > VFS_CHUNK ? VFS_CHUNK : count - readcount;
+		int ret = node->fs->calls->read(error, node, buff + readcount, size, offset + readcount);
+
+		if(ret == -1){
+			if(readcount == 0)
+				readcount = -1;
+			break;
+		}
+
+		readcount += ret;
+
+		if(ret < size)
+			break;
+
+		ticketlock_break(&node->lock);
+
+	}
 	
-	spinlock_release(&lock);
+	ticketlock_release(&node->lock);
 
 	return readcount;
 
@@ -195,18 +244,25 @@ int vfs_close(vnode_t* node){
 	if(!node->fs->calls->close)
 		return ENOSYS;
 		
-	spinlock_acquire(&lock);
-	
-	vfs_releasenode(node);
+	ticketlock_acquire(&lock);
 
 	int status = 0;
+	epoll_t* epoll = NULL;
 	
 	// TODO free pipe if one
 
-	if(node->refcount == 0)
+	if(__atomic_sub_fetch(&node->refcount, 1, __ATOMIC_ACQ_REL) == 0){
+		if(GETTYPE(node->st.st_mode) == TYPE_EPOLL)
+			epoll = node->objdata;
 		status = node->fs->calls->close(node);
+	}
 	
-	spinlock_release(&lock);
+	ticketlock_release(&lock);
+
+	// this closes the watched vnodes, so it can't be done with the lock held
+
+	if(epoll)
+		epoll_destroy(epoll);
 	
 	return status;
 }
@@ -218,7 +274,7 @@ int vfs_getdirent(dirnode_t* node, dent_t* buff, size_t count, uintmax_t offset,
 	if(!node->vnode.fs->calls->getdirent)
 		return ENOSYS;
 
-	spinlock_acquire(&lock);
+	ticketlock_acquire(&node->vnode.lock);
 	
 
 	if(GETTYPE(node->vnode.st.st_mode) != TYPE_DIR){
@@ -230,7 +286,7 @@ int vfs_getdirent(dirnode_t* node, dent_t* buff, size_t count, uintmax_t offset,
 
 	_ret:
 
-	spinlock_release(&lock);
+	ticketlock_release(&node->vnode.lock);
 
 	return err;
 }
@@ -240,17 +296,12 @@ int vfs_open(vnode_t** buff, dirnode_t* ref, char* path){
 
 	vnode_t* node;
 	
-	spinlock_acquire(&lock);
-	
 	int res = vfs_resolvepath(&node, NULL, ref, path, NULL, true, VFS_MAX_LOOP);
 	
-	if(res){
-		spinlock_release(&lock);
+	if(res)
 		return res;
-	}
+
 	vfs_acquirenode(node);
-	
-	spinlock_release(&lock);
 
 	*buff = node;
 
@@ -260,13 +311,13 @@ int vfs_open(vnode_t** buff, dirnode_t* ref, char* path){
 
 int vfs_map(vnode_t* node, void* addr, size_t len, size_t offset, size_t mmuflags){
 	
-	spinlock_acquire(&lock);
+	ticketlock_acquire(&lock);
 	
 	int err;
 
 	if(GETTYPE(node->st.st_mode) == TYPE_CHARDEV){
 		err = devman_map(node->st.st_rdev, addr, len, offset, mmuflags);
-		++node->refcount;
+		vfs_acquirenode(node);
 		goto _back;
 	}
 
@@ -275,80 +326,81 @@ int vfs_map(vnode_t* node, void* addr, size_t len, size_t offset, size_t mmuflag
 		goto _back;
 	}
 
-	++node->refcount;
+	vfs_acquirenode(node);
 
 	_back:
 
-	spinlock_release(&lock);
+	ticketlock_release(&lock);
 
 	return err;
 
 }
 
-int vfs_create(dirnode_t* ref, char* path, mode_t mode){
-	
-	dirnode_t* parent = NULL;
-	dirnode_t* buff   = NULL;
+// finds the folder a new node goes in and returns with its lock held.
+// the name is looked up again under the lock, something else could have
+// made it since the walk
 
-	char name[512];
+static int lockparent(dirnode_t** parent, dirnode_t* ref, char* path, char* name){
 	
-	spinlock_acquire(&lock);
+	dirnode_t* buff = NULL;
 
-	int result = vfs_resolvepath(&buff, &parent, ref, path, name, true, VFS_MAX_LOOP);
+	*parent = NULL;
 
-	if(buff){
-		spinlock_release(&lock);
+	int result = vfs_resolvepath(&buff, parent, ref, path, name, true, VFS_MAX_LOOP);
+
+	if(buff)
 		return EEXIST;
-	}
 
-	if(!parent){
-		spinlock_release(&lock);
+	if(!*parent)
 		return result;
+
+	ticketlock_acquire(&(*parent)->vnode.lock);
+
+	if(hashtable_isset(&(*parent)->children, name)){
+		ticketlock_release(&(*parent)->vnode.lock);
+		return EEXIST;
 	}
+
+	return 0;
+
+}
+
+int vfs_create(dirnode_t* ref, char* path, mode_t mode){
 	
-	if(!parent->vnode.fs->calls->create){
-		spinlock_release(&lock);
-		return ENOSYS;
-	}
+	dirnode_t* parent;
+	char name[512];
+	
+	int result = lockparent(&parent, ref, path, name);
 
-	result = parent->vnode.fs->calls->create(parent, name, mode);
+	if(result)
+		return result;
 	
-	spinlock_release(&lock);
+	if(parent->vnode.fs->calls->create)
+		result = parent->vnode.fs->calls->create(parent, name, mode);
+	else
+		result = ENOSYS;
 	
-	if(result) return result;
+	ticketlock_release(&parent->vnode.lock);
 	
-	return 0;
+	return result;
 }
 
 int vfs_mksocket(dirnode_t* ref, char* path, mode_t mode){
 		
-	dirnode_t* parent = NULL;
-	dirnode_t* buff   = NULL;
-
+	dirnode_t* parent;
 	char name[512];
 	
-	spinlock_acquire(&lock);
+	int result = lockparent(&parent, ref, path, name);
 
-	int result = vfs_resolvepath(&buff, &parent, ref, path, name, true, VFS_MAX_LOOP);
-
-	if(buff){
-		spinlock_release(&lock);
-		return EEXIST;
-	}
-
-	if(!parent){
-		spinlock_release(&lock);
+	if(result)
 		return result;
-	}
 
-	if(!parent->vnode.fs->calls->mksocket){
-		spinlock_release(&lock);
-		return ENOSYS;
-	}
-
-	result = parent->vnode.fs->calls->mksocket(parent, name, mode);
+	if(parent->vnode.fs->calls->mksocket)
+		result = parent->vnode.fs->calls->mksocket(parent, name, mode);
+	else
+		result = ENOSYS;
 	
-	spinlock_release(&lock);
+	ticketlock_release(&parent->vnode.lock);
 	
 	return result;
 }
@@ -358,100 +410,62 @@ int vfs_symlink(dirnode_t* ref, char* path, char* target, mode_t mode){
 	if(strlen(target) >= 512)
 		return ENAMETOOLONG;
 	
-	dirnode_t* parent = NULL;
-	dirnode_t* buff   = NULL;
+	dirnode_t* parent;
 	char name[512];
 
-        spinlock_acquire(&lock);
-
-        int result = vfs_resolvepath(&buff, &parent, ref, path, name, true, VFS_MAX_LOOP);
-
-        if(buff){
-                spinlock_release(&lock);
-                return EEXIST;
-        }
-
-        if(!parent){
-                spinlock_release(&lock);
-                return result;
-        }
+	int result = lockparent(&parent, ref, path, name);
 
-        if(!parent->vnode.fs->calls->symlink){
-                spinlock_release(&lock);
-                return ENOSYS;
-        }
+	if(result)
+		return result;
 
-        result = parent->vnode.fs->calls->symlink(parent, name, target, mode);
+	if(parent->vnode.fs->calls->symlink)
+		result = parent->vnode.fs->calls->symlink(parent, name, target, mode);
+	else
+		result = ENOSYS;
 
-        spinlock_release(&lock);
+	ticketlock_release(&parent->vnode.lock);
 
 	return result;
 
-
 }
 
 int vfs_link(dirnode_t* ref, vnode_t* link, char* path){
 	
-	dirnode_t* parent = NULL;
-	dirnode_t* buff   = NULL;
+	dirnode_t* parent;
 	char name[512];
 
-        spinlock_acquire(&lock);
-
-        int result = vfs_resolvepath(&buff, &parent, ref, path, name, true, VFS_MAX_LOOP);
-
-        if(buff){
-                spinlock_release(&lock);
-                return EEXIST;
-        }
-
-        if(!parent){
-                spinlock_release(&lock);
-                return result;
-        }
+	int result = lockparent(&parent, ref, path, name);
 
-        if(!parent->vnode.fs->calls->link){
-                spinlock_release(&lock);
-                return ENOSYS;
-        }
-	
-	if(link->fs != parent->vnode.fs)
-		return EXDEV;
+	if(result)
+		return result;
 
-        result = parent->vnode.fs->calls->link(parent, link, name);
+	if(!parent->vnode.fs->calls->link)
+		result = ENOSYS;
+	else if(link->fs != parent->vnode.fs)
+		result = EXDEV;
+	else
+		result = parent->vnode.fs->calls->link(parent, link, name);
 
-        spinlock_release(&lock);
+	ticketlock_release(&parent->vnode.lock);
 	
 	return result;
 
-
 }
 
 
 int vfs_mkdir(dirnode_t* ref, char* path, mode_t mode){
 
-	dirnode_t* parent = NULL;
-	dirnode_t* buff = NULL;
-
+	dirnode_t* parent;
 	char name[512];
 	
-	spinlock_acquire(&lock);
+	int result = lockparent(&parent, ref, path, name);
 
-	int result = vfs_resolvepath(&buff, &parent, ref, path, name, true, VFS_MAX_LOOP);
-
-	if(buff){
-		spinlock_release(&lock);
-		return EEXIST;
-	}
-
-	if(!parent){
-		spinlock_release(&lock);
+	if(result)
 		return result;
-	}
 
 	result = parent->vnode.fs->calls->mkdir(parent, name, mode);
 	
-	spinlock_release(&lock);
+	ticketlock_release(&parent->vnode.lock);
 	
 	return result;
 }
@@ -467,7 +481,7 @@ int vfs_mount(dirnode_t* ref, char* device, char* mountpoint, char* fs, int moun
 	dirnode_t* mountdir = ref;
 	dirnode_t* parent = NULL;
 	
-	spinlock_acquire(&lock);
+	ticketlock_acquire(&lock);
 
 	if(device){
 		dev = ref;
@@ -475,7 +489,7 @@ int vfs_mount(dirnode_t* ref, char* device, char* mountpoint, char* fs, int moun
 			int result = vfs_resolvepath(&dev, &parent, ref, device, NULL, true, VFS_MAX_LOOP);
 			
 			if(result){
-				spinlock_release(&lock);
+				ticketlock_release(&lock);
 				return result;
 			}
 		}
@@ -485,18 +499,18 @@ int vfs_mount(dirnode_t* ref, char* device, char* mountpoint, char* fs, int moun
 	int result = vfs_resolvepath(&mountdir, &parent, ref, mountpoint, NULL, true, VFS_MAX_LOOP);
 	
 	if(result){
-		spinlock_release(&lock);
+		ticketlock_release(&lock);
 		return result;
 	}
 
 	if(GETTYPE(mountdir->vnode.st.st_mode) != TYPE_DIR){
-		spinlock_release(&lock);
+		ticketlock_release(&lock);
 		return ENOTDIR;
 	}
 
 	result = fscalls->mount(mountdir, dev, mountflags, fsinfo);
 	
-	spinlock_release(&lock);
+	ticketlock_release(&lock);
 
 	return result;
 }
@@ -602,7 +616,9 @@ int vfs_resolvepath(vnode_t** result, dirnode_t** resultparent, dirnode_t* ref,
 			size_t size;
 			char* linkname;
 			
+			ticketlock_acquire(&iterator->vnode.lock);
 			int error = iterator->vnode.fs->calls->readlink(iterator, &linkname, &size);
+			ticketlock_release(&iterator->vnode.lock);
 			if(error)
 				return error;
 			
@@ -636,8 +652,12 @@ int vfs_resolvepath(vnode_t** result, dirnode_t** resultparent, dirnode_t* ref,
 		vnode_t* child = hashtable_get(&iterator->children, name);
 
 		if(!child){
-			// open it
-			int status = iterator->vnode.fs->calls->open(iterator, name);
+			// open it, under the folder's lock so it's only done once
+			ticketlock_acquire(&iterator->vnode.lock);
+			int status = 0;
+			if(!hashtable_get(&iterator->children, name))
+				status = iterator->vnode.fs->calls->open(iterator, name);
+			ticketlock_release(&iterator->vnode.lock);
 			if(status){
 				if(!path[nameoffset]){
 					if(namebuff)
@@ -675,7 +695,9 @@ int vfs_resolvepath(vnode_t** result, dirnode_t** resultparent, dirnode_t* ref,
 		size_t size;
 		char* linkname;
 		
+		ticketlock_acquire(&iterator->vnode.lock);
 		int error = iterator->vnode.fs->calls->readlink(iterator, &linkname, &size);
+		ticketlock_release(&iterator->vnode.lock);
 		if(error)
 			return error;
 		
@@ -715,11 +737,11 @@ dirnode_t* vfs_root(){
 }
 
 void vfs_acquirenode(vnode_t* node){
-	++node->refcount;
+	__atomic_add_fetch(&node->refcount, 1, __ATOMIC_RELAXED);
 }
 
 void vfs_releasenode(vnode_t* node){
-	--node->refcount;
+	__atomic_sub_fetch(&node->refcount, 1, __ATOMIC_ACQ_REL);
 }
 
 #include <kernel/tmpfs.h>
@@ -5,19 +5,39 @@
 #include <stdbool.h>
 #include <stdint.h>
 
-typedef struct{
-	void* next;
+typedef struct _hashtableentry{
+	struct _hashtableentry* next;
 	char* key;
 	void* val;
 } hashtableentry;
 
+// the buckets are replaced as a whole when the table grows
+
 typedef struct{
 	size_t size;
+	hashtableentry* entries[];
+} hashtablebuckets;
+
+// lookups don't take a lock and can run next to a writer, the writers
+// (insert, remove, set and destroy) have to be kept apart by the caller.
+// removed entries and old buckets are only freed once no lookup can see them
+
+typedef struct{
 	size_t entrycount;
-	hashtableentry* entries;
+	hashtablebuckets* buckets;
 } hashtable;
 
+// walks the entries in offset order, without starting over for each one.
+// the table can't change while it is used
+
+typedef struct{
+	size_t bucket;
+	hashtableentry* entry;
+} hashtableiter;
+
 void* hashtable_fromoffset(hashtable*, uintmax_t, char*);
+void hashtable_iterstart(hashtable*, hashtableiter*, uintmax_t);
+void* hashtable_iternext(hashtable*, hashtableiter*, char*);
 bool hashtable_init(hashtable*, size_t);
 bool hashtable_insert(hashtable*, char*, void*);
 bool hashtable_remove(hashtable*, char*);
@@ -1,101 +1,220 @@
 #include <hashtable.h>
 #include <string.h>
 #include <kernel/alloc.h>
+#include <kernel/rcu.h>
 
-size_t hash(char* ptr, size_t size){
-	size_t hash = 0;
-	for(size_t i = 0; i < size; ++i){
-		hash += ptr[i] * 9;
+// the table doubles once it has this many entries per bucket
+#define LOADFACTOR 2
+
+// fnv-1a
+
+static size_t hash(char* key){
+	size_t hash = 0xcbf29ce484222325;
+	for(; *key; ++key){
+		hash ^= (unsigned char)*key;
+		hash *= 0x100000001b3;
 	}
 
-	return hash % 883;
+	return hash;
+
+}
+
+static hashtablebuckets* newbuckets(size_t size){
+	hashtablebuckets* buckets = alloc(sizeof(hashtablebuckets) + size*sizeof(hashtableentry*));
+	if(!buckets) return NULL;
+	buckets->size = size;
+	return buckets;
+}
+
+// frees the entries but not the keys, which may have moved to another table
 
+static void freeentries(hashtablebuckets* buckets){
+	for(size_t i = 0; i < buckets->size; ++i){
+		hashtableentry* entry = buckets->entries[i];
+		while(entry){
+			hashtableentry* next = entry->next;
+			free(entry);
+			entry = next;
+		}
+	}
 }
 
 bool hashtable_init(hashtable* table, size_t size){
-	table->entries = alloc(size*sizeof(hashtableentry));
-	if(!table->entries) return false;
-	table->size = size;
+	table->buckets = newbuckets(size);
+	if(!table->buckets) return false;
+	table->entrycount = 0;
 	return true;
 }
 
-static inline hashtableentry* getentry(hashtable* table, char* key){
-	if(!table->size)
+// expects to be in a read side or to be the writer
+
+static hashtableentry* find(hashtablebuckets* buckets, char* key){
+	
+	if(!buckets->size)
 		return NULL;
-	size_t entryn = hash(key, strlen(key)) % table->size;
 
-	return &table->entries[entryn];
+	hashtableentry* entry = __atomic_load_n(&buckets->entries[hash(key) % buckets->size], __ATOMIC_ACQUIRE);
+
+	while(entry && strcmp(entry->key, key))
+		entry = __atomic_load_n(&entry->next, __ATOMIC_ACQUIRE);
+
+	return entry;
+
 }
 
 bool hashtable_isset(hashtable* table, char* key){
 	
-	hashtableentry* entry = getentry(table, key);
+	rcu_readlock();
+
+	bool isset = find(__atomic_load_n(&table->buckets, __ATOMIC_ACQUIRE), key) != NULL;
+
+	rcu_readunlock();
 	
-	if(!entry)
-		return false;
+	return isset;
+}
 
-	if(!entry->key)
-		return false;
+void* hashtable_get(hashtable* table, char* key){
+	
+	rcu_readlock();
 
-	while(entry && strcmp(entry->key, key))
-		entry = entry->next;
+	hashtableentry* entry = find(__atomic_load_n(&table->buckets, __ATOMIC_ACQUIRE), key);
+	void* val = entry ? __atomic_load_n(&entry->val, __ATOMIC_ACQUIRE) : NULL;
 
-	if(!entry) return false;
+	rcu_readunlock();
+
+	return val;
+}
+
+// moves forward to the next entry with a value if the iterator isn't on one
+
+static void iterfind(hashtable* table, hashtableiter* iter){
+	for(;;){
+		while(!iter->entry && iter->bucket < table->buckets->size)
+			iter->entry = table->buckets->entries[iter->bucket++];
+
+		if(!iter->entry || iter->entry->val)
+			return;
+
+		iter->entry = iter->entry->next;
+	}
+}
+
+void hashtable_iterstart(hashtable* table, hashtableiter* iter, uintmax_t offset){
 	
-	return true;
+	iter->bucket = 0;
+	iter->entry = NULL;
+
+	iterfind(table, iter);
+
+	while(offset-- && iter->entry){
+		iter->entry = iter->entry->next;
+		iterfind(table, iter);
+	}
+
+}
+
+// returns NULL once every entry was seen
+
+void* hashtable_iternext(hashtable* table, hashtableiter* iter, char* retkey){
+	
+	hashtableentry* entry = iter->entry;
+
+	if(!entry)
+		return NULL;
+
+	if(retkey)
+		strcpy(retkey, entry->key);
+
+	iter->entry = entry->next;
+	iterfind(table, iter);
+
+	return entry->val;
+
 }
 
 void* hashtable_fromoffset(hashtable* table, uintmax_t offset, char* retkey){
+	
+	hashtableiter iter;
+
+	hashtable_iterstart(table, &iter, offset);
+
+	return hashtable_iternext(table, &iter, retkey);
 		
-	for(uintmax_t i = 0; i < table->size; ++i){
-		hashtableentry* entry = &table->entries[i];
-		if(!entry->val)
-			continue;
-		while(entry){
-			if(offset-- == 0){
-				if(retkey)
-					strcpy(retkey, entry->key);
-				return entry->val;
+}
+
+// lookups may still be walking the old chains, so every entry is copied
+// into the new buckets and the old ones go once the lookups are done.
+// the table just stays as it is if there is no memory for it
+
+static void grow(hashtable* table){
+	
+	hashtablebuckets* old = table->buckets;
+
+	if(old->size == 0 || table->entrycount < old->size * LOADFACTOR)
+		return;
+
+	hashtablebuckets* new = newbuckets(old->size * 2);
+
+	if(!new)
+		return;
+
+	for(size_t i = 0; i < old->size; ++i){
+		for(hashtableentry* entry = old->entries[i]; entry; entry = entry->next){
+			hashtableentry* copy = alloc(sizeof(hashtableentry));
+
+			if(!copy){
+				freeentries(new);
+				free(new);
+				return;
 			}
 
-			entry = entry->next;
+			size_t bucket = hash(entry->key) % new->size;
+
+			copy->key = entry->key;
+			copy->val = entry->val;
+			copy->next = new->entries[bucket];
+			new->entries[bucket] = copy;
 		}
 	}
 
-	return NULL;
-		
+	__atomic_store_n(&table->buckets, new, __ATOMIC_RELEASE);
+
+	rcu_synchronize();
+
+	freeentries(old);
+	free(old);
+
 }
 
+// the entry is filled before it is linked in, so lookups never see it half done
+
 bool hashtable_insert(hashtable* table, char* key, void* val){
 
-	
-	hashtableentry* entry = getentry(table, key);
+	if(!table->buckets->size)
+		return false;
 
-	if(!entry)
-		return NULL;
+	grow(table);
 
+	hashtableentry* entry = alloc(sizeof(hashtableentry));
 	char* keysave = alloc(strlen(key)+1);
 
-	if(!keysave) return false;
+	if(!entry || !keysave){
+		free(entry);
+		free(keysave);
+		return false;
+	}
 
 	memcpy(keysave, key, strlen(key)+1);
 
-	if(entry->key){
-		while(entry->next)
-			entry = entry->next;
+	entry->key = keysave;
+	entry->val = val;
 
-		entry->next = alloc(sizeof(hashtableentry));
+	hashtableentry** link = &table->buckets->entries[hash(key) % table->buckets->size];
 
-		if(!entry->next){
-			free(keysave);
-			return false;
-		}
+	while(*link)
+		link = &(*link)->next;
 
-		entry = entry->next;
-	}
-	
-	entry->key = keysave;
-	entry->val = val;
+	__atomic_store_n(link, entry, __ATOMIC_RELEASE);
 	++table->entrycount;
 
 	return true;
@@ -104,87 +223,55 @@ bool hashtable_insert(hashtable* table, char* key, void* val){
 
 bool hashtable_remove(hashtable* table, char* key){
 	
-	hashtableentry* entry = getentry(table, key);
-	
-	if(!entry) return false;
+	hashtablebuckets* buckets = table->buckets;
 
-	if(!entry->key) return false;
-	
-	hashtableentry* prev = NULL;
-	
-	while(entry){
-		if(!strcmp(entry->key, key))
-			break;
-		prev = entry;
-		entry = entry->next;
-	}
-	
-	if(!entry) return false;
+	if(!buckets->size)
+		return false;
 
-	if(prev){
-		prev->next = entry->next;
-		free(entry->key);
-		free(entry);
-	}
-	else{
-		if(entry->next){
-			void* addr = entry->next;
-			memcpy(entry, entry->next, sizeof(hashtableentry));
-			free(addr);
-		}
-		else{
-			memset(entry, 0, sizeof(hashtableentry));
-		}
-	}
+	hashtableentry** link = &buckets->entries[hash(key) % buckets->size];
+
+	while(*link && strcmp((*link)->key, key))
+		link = &(*link)->next;
 
+	hashtableentry* entry = *link;
+
+	if(!entry) return false;
+
+	__atomic_store_n(link, entry->next, __ATOMIC_RELEASE);
 	--table->entrycount;
 
+	rcu_synchronize();
+
+	free(entry->key);
+	free(entry);
+
 	return true;
 
 }
 
 bool hashtable_set(hashtable* table, char* key, void* value){
-	hashtableentry* entry = getentry(table, key);
 	
-	if(!entry)
-		return false;
-
-	if(!entry->key)
-		return false;
-
-	while(entry && strcmp(entry->key, key))
-		entry = entry->next;
+	hashtableentry* entry = find(table->buckets, key);
 
 	if(!entry) return false;
 	
-	entry->val = value;
+	__atomic_store_n(&entry->val, value, __ATOMIC_RELEASE);
 
 	return true;
 }
 
-void* hashtable_get(hashtable* table, char* key){
-	
-	hashtableentry* entry = getentry(table, key);
-	
-	if(!entry)
-		return NULL;
-
-	if(!entry->key)
-		return NULL;
-
-	while(entry && strcmp(entry->key, key))
-		entry = entry->next;
-
-	if(!entry) return NULL;
-	
-	return entry->val;
-}
+// nothing may be looking at the table anymore
 
 void hashtable_destroy(hashtable* table){
 	
-	// TODO fix memory leak bruh
-	
-	free(table->entries);
+	hashtablebuckets* buckets = table->buckets;
+
+	for(size_t i = 0; i < buckets->size; ++i){
+		for(hashtableentry* entry = buckets->entries[i]; entry; entry = entry->next)
+			free(entry->key);
+	}
 
+	freeentries(buckets);
+	free(buckets);
 
 }
@@ -2,7 +2,7 @@
 #define _DEVMAN_H_INCLUDE
 
 #include <sys/stat.h>
-#include <poll.h>
+#include <kernel/poll.h>
 
 #define MAJOR_CONSOLE 1
 #define MAJOR_ZERO 2
@@ -13,6 +13,8 @@
 #define MAJOR_E9OUT 7
 #define MAJOR_MOUSE 8
 #define MAJOR_BLOCK 9
+#define MAJOR_SCHEDSTAT 10
+#define MAJOR_LOCKSTAT 11
 
 
 typedef struct{
@@ -21,7 +23,7 @@ typedef struct{
 	int (*isatty)(int minor);
 	int (*isseekable)(int minor, size_t* seekmax);
 	int (*ioctl)(int minor, unsigned long request, void* arg, int* result);
-	int (*poll)(int minor, pollfd* fd);
+	int (*poll)(int minor, pollfd* fd, poll_table* table);
 	int (*map)(int minor, void* addr, size_t len, size_t offset, size_t mmuflags);
 } devcalls;
 
@@ -31,7 +33,7 @@ int devman_newdevice(char* name, int type, int major, int minor, devcalls* calls
 int devman_isatty(int dev);
 int devman_isseekable(int dev, size_t* seekmax);
 int devman_ioctl(int dev, unsigned long request, void* arg, int* result);
-int devman_poll(int dev, pollfd* fd);
+int devman_poll(int dev, pollfd* fd, poll_table* table);
 int devman_map(int dev, void* addr, size_t len, size_t offset, size_t mmuflags);
 void devman_init();
 
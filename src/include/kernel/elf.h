@@ -30,6 +30,7 @@
 #define AT_PHENT 4
 #define AT_PHNUM 5
 #define AT_ENTRY 9
+#define AT_SYSINFO_EHDR 33
 
 typedef struct{
 	uint64_t a_type;
@@ -41,6 +42,7 @@ typedef struct {
 	auxv64_t phnum;
 	auxv64_t phent;
 	auxv64_t entry;
+	auxv64_t sysinfoehdr;
 	auxv64_t null;
 } auxv64_list;
 
@@ -0,0 +1,86 @@
+#ifndef _EPOLL_H_INCLUDE
+#define _EPOLL_H_INCLUDE
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <rbtree.h>
+#include <kernel/event.h>
+#include <kernel/vfs.h>
+
+// vnode type of epoll instances, not a real file type
+#define TYPE_EPOLL 14
+
+#define EPOLL_CLOEXEC 02000000
+
+#define EPOLL_CTL_ADD 1
+#define EPOLL_CTL_DEL 2
+#define EPOLL_CTL_MOD 3
+
+#define EPOLLIN 0x001
+#define EPOLLPRI 0x002
+#define EPOLLOUT 0x004
+#define EPOLLERR 0x008
+#define EPOLLHUP 0x010
+#define EPOLLRDNORM 0x040
+#define EPOLLRDBAND 0x080
+#define EPOLLWRNORM 0x100
+#define EPOLLRDHUP 0x2000
+#define EPOLLONESHOT (1u << 30)
+#define EPOLLET (1u << 31)
+
+// these are always reported
+#define EPOLL_ALWAYS (EPOLLERR | EPOLLHUP)
+
+// an fd registers on at most 2 events
+#define EPOLL_MAXWATCHES 2
+
+typedef struct{
+	uint32_t events;
+	uint64_t data;
+} __attribute__((packed)) epoll_event;
+
+struct _epollitem;
+struct _epoll_t;
+
+typedef struct{
+	event_waiter waiter;
+	event_t* event;
+	struct _epollitem* item;
+} epoll_watch;
+
+typedef struct _epollitem{
+	rbnode_t node;
+	int ifd;
+	vnode_t* vnode;
+	uint32_t events;
+	uint64_t data;
+	struct _epoll_t* epoll;
+	bool ready;
+	struct _epollitem* readynext;
+	struct _epollitem* readyprev;
+	size_t watchcount;
+	epoll_watch watches[EPOLL_MAXWATCHES];
+} epollitem;
+
+// the interest set is only changed and walked with ctllock held.
+// readylock only covers the ready list, it is taken from the event callbacks
+// (possibly in interrupt context) so it is always held with interrupts off
+
+typedef struct _epoll_t{
+	int ctllock;
+	int readylock;
+	rbtree_t items;
+	epollitem* readyfirst;
+	epollitem* readylast;
+	size_t readycount;
+	event_t event;
+} epoll_t;
+
+epoll_t* epoll_create();
+void epoll_destroy(epoll_t* epoll);
+int epoll_ctl(epoll_t* epoll, int op, int ifd, vnode_t* vnode, epoll_event* event);
+int epoll_wait(epoll_t* epoll, epoll_event* events, int maxevents, int timeoutms, int* count);
+int epoll_poll(epoll_t* epoll, pollfd* fd, poll_table* table);
+
+#endif
@@ -4,18 +4,37 @@
 #include <stdbool.h>
 #include <stddef.h>
 
-#define EVENT_MAX_THREADS 100
-
 typedef struct _thread_t thread_t;
 
+// waiters live on the waiting thread's stack and are linked in fifo order.
+// signalers unlink the ones they wake.
+// waiters with a wake callback (used by poll) get it called on every signal
+// instead, stay queued until removed and don't count as woken
+
+typedef struct _event_waiter{
+	struct _event_waiter* next;
+	struct _event_waiter* prev;
+	thread_t* thread;
+	void (*wake)(struct _event_waiter* waiter);
+	bool queued;
+} event_waiter;
+
 typedef struct _event_t{
 	int lock;
-	thread_t* threads[EVENT_MAX_THREADS];
+	event_waiter* first;
+	event_waiter* last;
 } event_t;
 
 #include <kernel/sched.h>
 
+// the signal functions return how many threads were woken up
+
 int event_signal(event_t* event, bool interruptson);
+int event_signalone(event_t* event, bool interruptson);
+int event_signaln(event_t* event, size_t n, bool interruptson);
 int event_wait(event_t* event, bool interruptible);
+int event_waitlocked(event_t* event, bool interruptible, int* lock);
+void event_addwaiter(event_t* event, event_waiter* waiter, thread_t* thread);
+void event_removewaiter(event_t* event, event_waiter* waiter);
 
 #endif
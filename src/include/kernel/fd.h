@@ -56,6 +56,7 @@ typedef struct {
 	fd_t** fd;
 } fdtable_t; 
 
+void fd_init();
 int fd_alloc(fdtable_t* fdtable, fd_t** fd, int* ifd, int lowest);
 int fd_free(fdtable_t* fdtable, int ifd);
 int fd_access(fdtable_t* fdtable, fd_t** fd, int ifd);
@@ -0,0 +1,15 @@
+#ifndef _KERNEL_KSTACK_H_INCLUDE
+#define _KERNEL_KSTACK_H_INCLUDE
+
+#include <stddef.h>
+
+// freed stacks of the default size kept per cpu
+#define KSTACK_CACHE_SIZE 8
+
+// unmapped pages below each stack
+#define KSTACK_GUARD_PAGES 1
+
+void* kstack_alloc(size_t size);
+void  kstack_free(void* base, size_t size);
+
+#endif
@@ -0,0 +1,33 @@
+#ifndef _LOCKSTAT_H_INCLUDE
+#define _LOCKSTAT_H_INCLUDE
+
+// lock profiling, only built with -DLOCKSTAT in KERNELCONFIG.
+// every acquisition is counted under the address it was called from
+// and the totals can be read from /dev/lockstat
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// locks a cpu can hold at once and still have their hold time measured
+#define LOCKSTAT_DEPTH 16
+
+typedef struct{
+	void* site;
+	size_t acquires;
+	size_t contended;
+	uint64_t spincycles;
+	uint64_t maxhold;
+} lockstat_entry;
+
+typedef struct{
+	void* lock;
+	lockstat_entry* entry;
+	uint64_t start;
+} lockstat_held;
+
+void lockstat_acquired(void* site, void* lock, uint64_t spinstart, bool contended);
+void lockstat_released(void* lock);
+void lockstat_init();
+
+#endif
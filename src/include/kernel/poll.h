@@ -0,0 +1,23 @@
+#ifndef _KERNEL_POLL_H_INCLUDE
+#define _KERNEL_POLL_H_INCLUDE
+
+#include <poll.h>
+#include <stddef.h>
+
+// event.h can't be included from here as it pulls in the vfs through sched.h
+
+struct _event_t;
+
+// passed down to the poll functions, which hand it every event that will be
+// signalled when the state they report changes. NULL when only checking
+
+typedef struct _poll_table{
+	void (*queue)(struct _poll_table* table, struct _event_t* event);
+} poll_table;
+
+static inline void poll_wait(poll_table* table, struct _event_t* event){
+	if(table)
+		table->queue(table, event);
+}
+
+#endif
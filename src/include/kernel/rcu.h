@@ -0,0 +1,13 @@
+#ifndef _RCU_H_INCLUDE
+#define _RCU_H_INCLUDE
+
+// read sides run with preemption off and can't sleep. rcu_synchronize
+// returns once every read side that was running when it was called is over,
+// after that whatever was unlinked before the call can be freed.
+// it can't be called from inside a read side
+
+void rcu_readlock();
+void rcu_readunlock();
+void rcu_synchronize();
+
+#endif
@@ -9,12 +9,43 @@
 #include <kernel/vmm.h>
 #include <kernel/fd.h>
 #include <stdbool.h>
+#include <rbtree.h>
+#include <arch/spinlock.h>
 
 #define THREAD_DEFAULT_KSTACK_SIZE PAGE_SIZE*10
+#define SCHEDULER_STACK_SIZE PAGE_SIZE*4
+
+// queue 0: interrupt threads
+// queue 1: kernel threads
+// queue 2: real time user threads
+// queue 3: user threads
+
+#define QUEUE_COUNT 4
 
 #define THREAD_PRIORITY_INTERRUPT 0
 #define THREAD_PRIORITY_KERNEL 1
-#define THREAD_PRIORITY_USER 2
+#define THREAD_PRIORITY_REALTIME 2
+#define THREAD_PRIORITY_USER 3
+
+// policies are numbered like linux's
+#define SCHED_OTHER 0
+#define SCHED_FIFO 1
+#define SCHED_RR 2
+
+#define SCHED_RTPRIO_MIN 1
+#define SCHED_RTPRIO_MAX 99
+
+#define SCHED_NICE_MIN -20
+#define SCHED_NICE_MAX 19
+
+#define SCHED_MAXCPUS 256
+
+// log2 buckets of microseconds, the last one takes everything above
+#define SCHED_HISTSIZE 32
+
+#define PRIO_PROCESS 0
+#define PRIO_PGRP 1
+#define PRIO_USER 2
 
 #define THREAD_STATE_WAITING 0
 #define THREAD_STATE_RUNNING 1
@@ -28,6 +59,35 @@
 
 typedef unsigned long state_t;
 
+struct sched_param{
+	int sched_priority;
+};
+
+// layout matches linux's cpu_set_t so the affinity syscalls can copy it as is
+
+typedef struct{
+	uint64_t bits[SCHED_MAXCPUS / 64];
+} cpuset_t;
+
+static inline bool cpuset_isset(cpuset_t* set, size_t cpu){
+	return cpu < SCHED_MAXCPUS && (set->bits[cpu / 64] & ((uint64_t)1 << (cpu % 64)));
+}
+
+static inline void cpuset_set(cpuset_t* set, size_t cpu){
+	if(cpu < SCHED_MAXCPUS)
+		set->bits[cpu / 64] |= (uint64_t)1 << (cpu % 64);
+}
+
+static inline void cpuset_clear(cpuset_t* set){
+	for(size_t i = 0; i < SCHED_MAXCPUS / 64; ++i)
+		set->bits[i] = 0;
+}
+
+static inline void cpuset_fill(cpuset_t* set){
+	for(size_t i = 0; i < SCHED_MAXCPUS / 64; ++i)
+		set->bits[i] = ~(uint64_t)0;
+}
+
 struct _proc_t;
 
 typedef struct _thread_t{
@@ -48,6 +108,29 @@ typedef struct _thread_t{
 	int umemoperror;
 	void (*umemopfailaddr)();
 	bool shouldexit;
+	int lock;
+	bool oncpu;
+	int lastcpu;
+	// where it is queued, changed with that queue's lock held. -1 if it isn't
+	int queuedcpu;
+	int queuedpriority;
+	rbnode_t fairnode;
+	uint64_t vruntime;
+	uint64_t runstart;
+	int nice;
+	int policy;
+	int rtpriority;
+	int rtlist;
+	bool rtfront;
+	uint64_t rrslice;
+	cpuset_t affinity;
+	uint64_t waitstart;
+	uint64_t waittime;
+	uint64_t maxlatency;
+	uint64_t runtime;
+	size_t voluntary;
+	size_t involuntary;
+	size_t preemptcount;
 } thread_t;
 
 typedef struct _proc_t{
@@ -71,10 +154,29 @@ typedef struct _proc_t{
 } proc_t;
 
 
+// the real time queue has a fifo per priority, the bitmap has the
+// priorities with threads queued
+
 typedef struct{
 	thread_t* start;
 	thread_t* end;
-	int lock;
+} sched_list;
+
+typedef struct{
+	uint64_t bitmap[2];
+	sched_list lists[SCHED_RTPRIO_MAX + 1];
+} sched_rtlists;
+
+// the user queue is ordered by vruntime, the others are fifos
+
+typedef struct{
+	thread_t* start;
+	thread_t* end;
+	ticketlock_t lock;
+	bool fair;
+	rbtree_t tree;
+	uint64_t minvruntime;
+	sched_rtlists* rt;
 } sched_queue;
 
 void sched_dequeue(long state);
@@ -83,9 +185,22 @@ thread_t* sched_newuthread(void* ip, size_t stacksize, void* stack, proc_t* proc
 thread_t* sched_newkthread(void* ip, size_t stacksize, bool run, int prio);
 void sched_queuethread(thread_t* thread);
 void sched_init();
+void sched_apinit();
+__attribute__((noreturn)) void sched_idle();
 void sched_runinit();
-void sched_eventsignal(event_t* event, thread_t* thread);
+bool sched_eventsignal(event_t* event, thread_t* thread);
+void sched_prepareblock(bool interruptible);
+void sched_cancelblock();
 void sched_block(bool interruptible);
 void sched_yield();
+void sched_preempt();
 void sched_threadexitcheck();
+void sched_resched();
+int sched_setaffinity(thread_t* thread, cpuset_t* set);
+int sched_setscheduler(thread_t* thread, int policy, int rtpriority);
+void sched_copypolicy(thread_t* thread, thread_t* from);
+thread_t* sched_findthread(pid_t tid);
+void sched_freethread(thread_t* thread);
+void sched_freeproc(proc_t* proc);
+void schedstat_init();
 #endif
@@ -4,9 +4,35 @@
 
 #include <stddef.h>
 
+#define SLAB_MAXCACHES 8
+#define SLAB_CPUCACHE_SIZE 16
+
+// objects taken from a new chunk at least
+#define SLAB_CACHE_MINOBJS 16
+
+typedef struct{
+	size_t count;
+	void* objs[SLAB_CPUCACHE_SIZE];
+} slab_cpucache;
+
+// typed object cache. objects are exactly sized and freed ones are kept on per cpu lists,
+// ctor prepares an object on every allocation, without one the object is zeroed
+
+typedef struct{
+	int lock;
+	int id;
+	size_t size;
+	void (*ctor)(void*);
+	void* freelist;
+} slab_cache;
+
 void* slab_alloc(size_t);
 void  slab_free(void*);
 size_t slab_getentrysize(void*);
 void slab_init();
 
+void  slab_cacheinit(slab_cache* cache, size_t size, void (*ctor)(void*));
+void* slab_cachealloc(slab_cache* cache);
+void  slab_cachefree(slab_cache* cache, void* obj);
+
 #endif
@@ -41,7 +41,8 @@ typedef struct _socket_t{
 	struct _socket_t** backlog;
 	event_t connectevent; // when the socket is listening and this is fired, someone used connect() on the socket
 	event_t acceptevent;  // when a socket is waiting for a connection to be accepted, it sleeps on this
-	event_t dataevent; // fired when data is written to/read from the ring buffer
+	event_t dataevent; // fired when data is written to the ring buffer, readers sleep on it
+	event_t spaceevent; // fired when data is read from the ring buffer, writers sleep on it
 	int state;
 	union {
 		sockaddr_un addr_un;
@@ -78,4 +79,5 @@ int socket_bind(struct _socket_t* sock, void* addr, socklen_t addrlen);
 int socket_listen(struct _socket_t* sock, int backlog);
 int socket_accept(socket_t** peer, socket_t* sock, void* addr, socklen_t* addrlen, fd_t* fd);
 int socket_send(socket_t* socket, void* buff, size_t len, int flags, int* error, fd_t* fd);
+int socket_poll(socket_t* socket, pollfd* fd, poll_table* table);
 #endif
@@ -3,19 +3,30 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
+#include <rbtree.h>
 #include <arch/regs.h>
 
+// a request that was added has to be removed before its memory goes away,
+// even if it already fired, as its callback may still be running on another cpu
+
 typedef struct _timer_req{
 	// values callee should care about
 	void* (*func)(arch_regs*, void*);
 	void* argptr;
 	// internal values
-	struct _timer_req* next;
-	size_t ticks;
+	rbnode_t node;
+	uint64_t deadline;
+	size_t queuedon; // cpu number + 1, 0 if not queued
+	size_t running;  // cpu number + 1 while the callback runs
 } timer_req;
 
 void timer_init();
+uint64_t timer_now();
 void timer_add(timer_req* req, size_t us, bool start);
+void timer_addabs(timer_req* req, uint64_t deadline, bool start);
+bool timer_remove(timer_req* req);
+void timer_migrate(timer_req* req);
 void timer_resume();
 void timer_stop();
 void timer_irq(arch_regs* ctx);
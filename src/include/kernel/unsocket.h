@@ -2,6 +2,7 @@
 #define _UNSOCKET_H_INCLUDE
 
 #include <kernel/socket.h>
+#include <kernel/poll.h>
 
 typedef struct {
 	short sun_family;
@@ -14,4 +15,5 @@ typedef unsigned socklen_t;
 int unsocket_new(struct _socket_t** returnptr, int type, int protocol);
 int unsocket_bind(struct _socket_t* sock, sockaddr_un* addr, socklen_t addrlen);
 int unsocket_send(struct _socket_t* socket, void* buff, size_t len, int flags, int* error, fd_t* fd);
+int unsocket_poll(struct _socket_t* socket, pollfd* fd, poll_table* table);
 #endif
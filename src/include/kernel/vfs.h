@@ -5,8 +5,9 @@
 #include <hashtable.h>
 #include <errno.h>
 #include <dirent.h>
-#include <poll.h>
+#include <kernel/poll.h>
 #include <stdbool.h>
+#include <arch/spinlock.h>
 
 struct _vnode_t;
 struct _fscalls_t;
@@ -27,9 +28,13 @@ typedef struct _vnode_t {
 	size_t refcount;
 	struct _dirnode_t* parent;
 	void* objdata;
+	// the file data for regular files and links, the children for folders
+	ticketlock_t lock;
 } vnode_t;
 
-// folders are an expansion of vnode_t to save memory
+// folders are an expansion of vnode_t to save memory.
+// nodes are never freed while they are in a folder, so paths are walked
+// without taking a lock
 
 typedef struct _dirnode_t{
 	vnode_t vnode;
@@ -86,7 +91,7 @@ int vfs_read(int* error, vnode_t* node, void* buff, size_t count, size_t offset,
 int vfs_isatty(vnode_t* node);
 int vfs_getdirent(dirnode_t* node, dent_t* buff, size_t count, uintmax_t offset, size_t* readcount);
 int vfs_ioctl(vnode_t* node, unsigned long request, void* arg, int* result);
-int vfs_poll(vnode_t* node, pollfd* fd);
+int vfs_poll(vnode_t* node, pollfd* fd, poll_table* table);
 int vfs_chmod(vnode_t* node, mode_t mode);
 int vfs_symlink(dirnode_t* ref, char* path, char* target, mode_t mode);
 int vfs_link(dirnode_t* ref, vnode_t* link, char* path);
@@ -16,6 +16,8 @@
 #define VMM_TYPE_FREE 0
 #define VMM_TYPE_ANON 1
 #define VMM_TYPE_FILE 2
+// pages owned by the kernel, never freed with the mapping
+#define VMM_TYPE_SHARED 3
 
 struct vmm_cacheheader;
 
@@ -61,6 +63,7 @@ int 		vmm_dealwithrequest(void* addr, long error, bool user);
 bool 		vmm_setused(void* addr, size_t pagec, size_t mmuflags);
 bool		vmm_unmap(void* addr, size_t pagec);
 bool		vmm_map(void* paddr, void* vaddr, size_t pagec, size_t mmuflags);
+bool		vmm_mapshared(void* paddr, void* vaddr, size_t pagec, size_t mmuflags);
 void*		vmm_alloc(size_t pagec, size_t mmuflags);
 bool		vmm_setfree(void* addr, size_t pagec);
 bool		vmm_allocnowat(void* addr, size_t mmuflags, size_t size);
@@ -0,0 +1,38 @@
+#ifndef _RBTREE_H_INCLUDE
+#define _RBTREE_H_INCLUDE
+
+#include <stddef.h>
+#include <stdbool.h>
+
+// intrusive red-black tree
+// nodes are embedded in the owning struct, the tree never allocates
+
+typedef struct _rbnode_t{
+	struct _rbnode_t* parent;
+	struct _rbnode_t* left;
+	struct _rbnode_t* right;
+	bool red;
+} rbnode_t;
+
+// returns < 0 if a goes before b
+typedef int (*rbtree_cmp)(rbnode_t* a, rbnode_t* b);
+
+typedef struct{
+	rbnode_t* root;
+	rbnode_t* first;
+	size_t count;
+	rbtree_cmp cmp;
+} rbtree_t;
+
+#define RBTREE_ENTRY(node, type, member) ((type*)((char*)(node) - offsetof(type, member)))
+
+void rbtree_init(rbtree_t* tree, rbtree_cmp cmp);
+void rbtree_insert(rbtree_t* tree, rbnode_t* node);
+void rbtree_remove(rbtree_t* tree, rbnode_t* node);
+rbnode_t* rbtree_next(rbnode_t* node);
+
+static inline rbnode_t* rbtree_first(rbtree_t* tree){
+	return tree->first;
+}
+
+#endif
@@ -0,0 +1,258 @@
+#include <rbtree.h>
+
+void rbtree_init(rbtree_t* tree, rbtree_cmp cmp){
+	tree->root = NULL;
+	tree->first = NULL;
+	tree->count = 0;
+	tree->cmp = cmp;
+}
+
+static void rotateleft(rbtree_t* tree, rbnode_t* node){
+	rbnode_t* right = node->right;
+
+	node->right = right->left;
+	if(right->left)
+		right->left->parent = node;
+
+	right->parent = node->parent;
+
+	if(!node->parent)
+		tree->root = right;
+	else if(node == node->parent->left)
+		node->parent->left = right;
+	else
+		node->parent->right = right;
+
+	right->left = node;
+	node->parent = right;
+}
+
+static void rotateright(rbtree_t* tree, rbnode_t* node){
+	rbnode_t* left = node->left;
+
+	node->left = left->right;
+	if(left->right)
+		left->right->parent = node;
+
+	left->parent = node->parent;
+
+	if(!node->parent)
+		tree->root = left;
+	else if(node == node->parent->right)
+		node->parent->right = left;
+	else
+		node->parent->left = left;
+
+	left->right = node;
+	node->parent = left;
+}
+
+static inline bool isred(rbnode_t* node){
+	return node && node->red;
+}
+
+// equal keys go to the right so they come out in insertion order
+
+void rbtree_insert(rbtree_t* tree, rbnode_t* node){
+
+	rbnode_t* parent = NULL;
+	rbnode_t** link = &tree->root;
+	bool leftmost = true;
+
+	while(*link){
+		parent = *link;
+		if(tree->cmp(node, parent) < 0)
+			link = &parent->left;
+		else{
+			link = &parent->right;
+			leftmost = false;
+		}
+	}
+
+	node->parent = parent;
+	node->left = node->right = NULL;
+	node->red = true;
+	*link = node;
+
+	if(leftmost)
+		tree->first = node;
+
+	++tree->count;
+
+	while(isred(node->parent)){
+		parent = node->parent;
+		rbnode_t* grandparent = parent->parent;
+
+		if(parent == grandparent->left){
+			rbnode_t* uncle = grandparent->right;
+			if(isred(uncle)){
+				parent->red = uncle->red = false;
+				grandparent->red = true;
+				node = grandparent;
+				continue;
+			}
+			if(node == parent->right){
+				rotateleft(tree, parent);
+				node = parent;
+				parent = node->parent;
+			}
+			parent->red = false;
+			grandparent->red = true;
+			rotateright(tree, grandparent);
+		}
+		else{
+			rbnode_t* uncle = grandparent->left;
+			if(isred(uncle)){
+				parent->red = uncle->red = false;
+				grandparent->red = true;
+				node = grandparent;
+				continue;
+			}
+			if(node == parent->left){
+				rotateright(tree, parent);
+				node = parent;
+				parent = node->parent;
+			}
+			parent->red = false;
+			grandparent->red = true;
+			rotateleft(tree, grandparent);
+		}
+	}
+
+	tree->root->red = false;
+
+}
+
+rbnode_t* rbtree_next(rbnode_t* node){
+
+	if(node->right){
+		node = node->right;
+		while(node->left)
+			node = node->left;
+		return node;
+	}
+
+	while(node->parent && node == node->parent->right)
+		node = node->parent;
+
+	return node->parent;
+
+}
+
+static void replace(rbtree_t* tree, rbnode_t* old, rbnode_t* new){
+	if(!old->parent)
+		tree->root = new;
+	else if(old == old->parent->left)
+		old->parent->left = new;
+	else
+		old->parent->right = new;
+
+	if(new)
+		new->parent = old->parent;
+}
+
+void rbtree_remove(rbtree_t* tree, rbnode_t* node){
+
+	if(tree->first == node)
+		tree->first = rbtree_next(node);
+
+	--tree->count;
+
+	// child takes the place of the removed node, parent is its new parent.
+	// child can be NULL so the parent has to be tracked separately
+
+	rbnode_t* child;
+	rbnode_t* parent;
+	bool removedred;
+
+	if(!node->left || !node->right){
+		child = node->left ? node->left : node->right;
+		parent = node->parent;
+		removedred = node->red;
+		replace(tree, node, child);
+	}
+	else{
+		rbnode_t* successor = node->right;
+		while(successor->left)
+			successor = successor->left;
+
+		removedred = successor->red;
+		child = successor->right;
+
+		if(successor->parent == node)
+			parent = successor;
+		else{
+			parent = successor->parent;
+			replace(tree, successor, child);
+			successor->right = node->right;
+			successor->right->parent = successor;
+		}
+
+		replace(tree, node, successor);
+		successor->left = node->left;
+		successor->left->parent = successor;
+		successor->red = node->red;
+	}
+
+	if(removedred)
+		return;
+
+	while(child != tree->root && !isred(child)){
+		if(child == parent->left){
+			rbnode_t* sibling = parent->right;
+			if(isred(sibling)){
+				sibling->red = false;
+				parent->red = true;
+				rotateleft(tree, parent);
+				sibling = parent->right;
+			}
+			if(!isred(sibling->left) && !isred(sibling->right)){
+				sibling->red = true;
+				child = parent;
+				parent = child->parent;
+				continue;
+			}
+			if(!isred(sibling->right)){
+				sibling->left->red = false;
+				sibling->red = true;
+				rotateright(tree, sibling);
+				sibling = parent->right;
+			}
+			sibling->red = parent->red;
+			parent->red = false;
+			sibling->right->red = false;
+			rotateleft(tree, parent);
+			child = tree->root;
+		}
+		else{
+			rbnode_t* sibling = parent->left;
+			if(isred(sibling)){
+				sibling->red = false;
+				parent->red = true;
+				rotateright(tree, parent);
+				sibling = parent->left;
+			}
+			if(!isred(sibling->left) && !isred(sibling->right)){
+				sibling->red = true;
+				child = parent;
+				parent = child->parent;
+				continue;
+			}
+			if(!isred(sibling->left)){
+				sibling->right->red = false;
+				sibling->red = true;
+				rotateleft(tree, sibling);
+				sibling = parent->left;
+			}
+			sibling->red = parent->red;
+			parent->red = false;
+			sibling->left->red = false;
+			rotateright(tree, parent);
+			child = tree->root;
+		}
+	}
+
+	if(child)
+		child->red = false;
+
+}
@@ -28,14 +28,18 @@ static int isseekable(int dev, size_t* seekmax){
 	return 0;
 
 }
-static int poll(int dev, pollfd* fd){
+// block devices are always ready, so there is nothing to wait on
+
+static int poll(int dev, pollfd* fd, poll_table* table){
 	
-	if(fd->events & POLLOUT)
+	if(fd->events & POLLIN)
 		fd->revents |= POLLIN;
 	
 	if(fd->events & POLLOUT)
 		fd->revents |= POLLOUT;
 
+	return 0;
+
 }
 
 int block_read(int* error, int dev, void* buffer, size_t count, size_t offset){
@@ -258,10 +258,10 @@ void nvme_irq(){
 	
 	for(int ctlr = 0; ctlr < controllercount; ++ctlr){
 		controllers[ctlr]->adminqueue.comp.hasdata = true;
-		event_signal(&controllers[ctlr]->adminqueue.update, false);
+		event_signalone(&controllers[ctlr]->adminqueue.update, false);
 		if(controllers[ctlr]->ioqueue){
 			controllers[ctlr]->ioqueue->comp.hasdata = true;
-			event_signal(&controllers[ctlr]->ioqueue->update, false);
+			event_signalone(&controllers[ctlr]->ioqueue->update, false);
 		}
 	}
 	apic_eoi();
@@ -323,7 +323,7 @@ __attribute__((noreturn)) static void nvme_workerthread(){
 				userentries[pair]->comp = compq[queuepair->comp.idx];
 
 
-				event_signal(&userentries[pair]->completion, false);
+				event_signalone(&userentries[pair]->completion, false);
 				
 				userentries[pair] = NULL;
 
@@ -352,7 +352,7 @@ __attribute__((noreturn)) static void nvme_workerthread(){
 static inline void dispatchandwait(entrypair_t* e, queuepair_t* q){
 	arch_interrupt_disable();
 	__assert(ringbuffer_write(&q->userrequests, &e, sizeof(entrypair_t*)));
-	event_signal(&q->update, false);
+	event_signalone(&q->update, false);
 	event_wait(&e->completion, false);
 	arch_interrupt_enable();
 }
@@ -547,9 +547,16 @@ static void nvme_newworkerthread(ctlrinfo_t* ctlr, queuepair_t* qpair){
 	ctlrpass = ctlr;
 	queuepass = qpair;
 
-	qpair->worker = sched_newkthread(nvme_workerthread, PAGE_SIZE*1000, true, THREAD_PRIORITY_KERNEL);
+	qpair->worker = sched_newkthread(nvme_workerthread, THREAD_DEFAULT_KSTACK_SIZE, false, THREAD_PRIORITY_KERNEL);
 	if(!qpair->worker)
 		_panic("Out of memory!", NULL);
+	
+	// keep the worker on the cpu the interrupt is routed to
+	
+	cpuset_clear(&qpair->worker->affinity);
+	cpuset_set(&qpair->worker->affinity, arch_getcls()->cpunum);
+
+	sched_queuethread(qpair->worker);
 
 }
 
@@ -94,14 +94,14 @@ int devman_ioctl(int dev, unsigned long request, void* arg, int* result){
 	return majorcalls[major(dev)]->ioctl(minor(dev), request, arg, result);
 }
 
-int devman_poll(int dev, pollfd* fd){
+int devman_poll(int dev, pollfd* fd, poll_table* table){
 	if(major(dev) > highestmajor)
 		return ENOTTY;
 	
 	if(!majorcalls[major(dev)]->poll)
 		return ENOTTY;
 
-	return majorcalls[major(dev)]->poll(minor(dev), fd);
+	return majorcalls[major(dev)]->poll(minor(dev), fd, table);
 }
 
 int devman_map(int dev, void* addr, size_t len, size_t offset, size_t mmuflags){
@@ -0,0 +1,479 @@
+#include <kernel/epoll.h>
+#include <kernel/alloc.h>
+#include <kernel/timer.h>
+#include <kernel/sched.h>
+#include <arch/spinlock.h>
+#include <arch/interrupt.h>
+#include <arch/cls.h>
+#include <kernel/fd.h>
+#include <errno.h>
+
+// every watched fd hangs a callback waiter on the events its poll function
+// hands out. the callbacks only put the item on the ready list, so epoll_wait
+// only has to look at the items that changed since the last call
+
+#define INTEREST(events) ((events) & ~(EPOLLET | EPOLLONESHOT))
+
+// items are keyed by fd number and vnode, so a reused fd number is a new item
+
+static int itemcmp(rbnode_t* a, rbnode_t* b){
+	epollitem* ia = RBTREE_ENTRY(a, epollitem, node);
+	epollitem* ib = RBTREE_ENTRY(b, epollitem, node);
+
+	if(ia->ifd != ib->ifd)
+		return ia->ifd < ib->ifd ? -1 : 1;
+
+	if(ia->vnode != ib->vnode)
+		return ia->vnode < ib->vnode ? -1 : 1;
+
+	return 0;
+}
+
+static epollitem* finditem(epoll_t* epoll, int ifd, vnode_t* vnode){
+
+	epollitem key = {
+		.ifd = ifd,
+		.vnode = vnode
+	};
+
+	rbnode_t* node = epoll->items.root;
+
+	while(node){
+		int cmp = itemcmp(&key.node, node);
+		if(cmp == 0)
+			return RBTREE_ENTRY(node, epollitem, node);
+		node = cmp < 0 ? node->left : node->right;
+	}
+
+	return NULL;
+
+}
+
+// these 2 expect readylock to be held
+
+static bool readyadd(epoll_t* epoll, epollitem* item){
+
+	if(item->ready)
+		return false;
+
+	item->ready = true;
+	item->readynext = NULL;
+	item->readyprev = epoll->readylast;
+
+	if(epoll->readylast)
+		epoll->readylast->readynext = item;
+	else
+		epoll->readyfirst = item;
+
+	epoll->readylast = item;
+	++epoll->readycount;
+
+	return true;
+
+}
+
+static void readyremove(epoll_t* epoll, epollitem* item){
+
+	if(!item->ready)
+		return;
+
+	if(item->readyprev)
+		item->readyprev->readynext = item->readynext;
+	else
+		epoll->readyfirst = item->readynext;
+
+	if(item->readynext)
+		item->readynext->readyprev = item->readyprev;
+	else
+		epoll->readylast = item->readyprev;
+
+	item->ready = false;
+	--epoll->readycount;
+
+}
+
+static void markready(epoll_t* epoll, epollitem* item){
+
+	bool intstate = arch_interrupt_save();
+	spinlock_acquire(&epoll->readylock);
+
+	bool added = readyadd(epoll, item);
+
+	spinlock_release(&epoll->readylock);
+
+	if(added)
+		event_signal(&epoll->event, false);
+
+	arch_interrupt_restore(intstate);
+
+}
+
+static void unready(epoll_t* epoll, epollitem* item){
+
+	bool intstate = arch_interrupt_save();
+	spinlock_acquire(&epoll->readylock);
+
+	readyremove(epoll, item);
+
+	spinlock_release(&epoll->readylock);
+	arch_interrupt_restore(intstate);
+
+}
+
+// runs with the watched event's lock held and interrupts off
+
+static void wake(event_waiter* waiter){
+
+	epollitem* item = ((epoll_watch*)waiter)->item;
+	epoll_t* epoll = item->epoll;
+
+	if(INTEREST(item->events) == 0)
+		return;
+
+	spinlock_acquire(&epoll->readylock);
+
+	bool added = readyadd(epoll, item);
+
+	spinlock_release(&epoll->readylock);
+
+	if(added)
+		event_signal(&epoll->event, false);
+
+}
+
+typedef struct{
+	poll_table table;
+	epollitem* item;
+} watchtable;
+
+static void queue(poll_table* ptable, event_t* event){
+
+	epollitem* item = ((watchtable*)ptable)->item;
+
+	// no poll function registers on more than EPOLL_MAXWATCHES events
+
+	if(item->watchcount == EPOLL_MAXWATCHES)
+		return;
+
+	epoll_watch* watch = &item->watches[item->watchcount++];
+	watch->event = event;
+	watch->item = item;
+	watch->waiter.wake = wake;
+
+	event_addwaiter(event, &watch->waiter, NULL);
+
+}
+
+// returns the events the item has right now
+
+static uint32_t pollitem(epollitem* item, poll_table* table){
+
+	if(INTEREST(item->events) == 0)
+		return 0;
+
+	pollfd fd = {
+		.events = INTEREST(item->events) & 0xFFFF
+	};
+
+	if(vfs_poll(item->vnode, &fd, table))
+		return EPOLLERR;
+
+	return (uint16_t)fd.revents & (INTEREST(item->events) | EPOLL_ALWAYS);
+
+}
+
+static uint32_t watch(epollitem* item){
+
+	watchtable table = {
+		.table.queue = queue,
+		.item = item
+	};
+
+	item->watchcount = 0;
+
+	return pollitem(item, &table.table);
+
+}
+
+// once this returns no callback can be running for the item
+
+static void unwatch(epollitem* item){
+
+	for(size_t i = 0; i < item->watchcount; ++i)
+		event_removewaiter(item->watches[i].event, &item->watches[i].waiter);
+
+	item->watchcount = 0;
+
+}
+
+static void removeitem(epoll_t* epoll, epollitem* item){
+
+	unwatch(item);
+	unready(epoll, item);
+	rbtree_remove(&epoll->items, &item->node);
+	vfs_close(item->vnode);
+	free(item);
+
+}
+
+epoll_t* epoll_create(){
+
+	epoll_t* epoll = alloc(sizeof(epoll_t));
+
+	if(!epoll)
+		return NULL;
+
+	rbtree_init(&epoll->items, itemcmp);
+
+	return epoll;
+
+}
+
+// called once the last reference to the instance is gone
+
+void epoll_destroy(epoll_t* epoll){
+
+	rbnode_t* node;
+
+	while((node = rbtree_first(&epoll->items)))
+		removeitem(epoll, RBTREE_ENTRY(node, epollitem, node));
+
+	free(epoll);
+
+}
+
+// the item holds a reference to the vnode, so it stays in the set until it
+// is deleted, its fd is found closed by epoll_wait or the instance is closed
+
+int epoll_ctl(epoll_t* epoll, int op, int ifd, vnode_t* vnode, epoll_event* event){
+
+	// nested epoll instances aren't supported
+
+	switch(GETTYPE(vnode->st.st_mode)){
+		case TYPE_FIFO:
+		case TYPE_SOCKET:
+		case TYPE_CHARDEV:
+		case TYPE_BLOCKDEV:
+			break;
+		default:
+			return EPERM;
+	}
+
+	int err = 0;
+
+	spinlock_acquire(&epoll->ctllock);
+
+	epollitem* item = finditem(epoll, ifd, vnode);
+
+	switch(op){
+		case EPOLL_CTL_ADD:
+			if(item){
+				err = EEXIST;
+				break;
+			}
+
+			item = alloc(sizeof(epollitem));
+
+			if(!item){
+				err = ENOMEM;
+				break;
+			}
+
+			item->ifd = ifd;
+			item->vnode = vnode;
+			item->epoll = epoll;
+			item->events = event->events;
+			item->data = event->data;
+
+			vfs_acquirenode(vnode);
+			rbtree_insert(&epoll->items, &item->node);
+
+			if(watch(item))
+				markready(epoll, item);
+
+			break;
+		case EPOLL_CTL_MOD:
+			if(!item){
+				err = ENOENT;
+				break;
+			}
+
+			// the events to watch depend on what is asked for
+
+			unwatch(item);
+			unready(epoll, item);
+
+			item->events = event->events;
+			item->data = event->data;
+
+			if(watch(item))
+				markready(epoll, item);
+
+			break;
+		case EPOLL_CTL_DEL:
+			if(!item){
+				err = ENOENT;
+				break;
+			}
+
+			removeitem(epoll, item);
+
+			break;
+		default:
+			err = EINVAL;
+	}
+
+	spinlock_release(&epoll->ctllock);
+
+	return err;
+
+}
+
+// closing an fd doesn't know about the items on it, so they are dropped once
+// the fd number in the calling process doesn't lead to the same vnode anymore
+
+static bool fdclosed(epollitem* item){
+
+	fd_t* fd;
+
+	if(fd_access(&arch_getcls()->thread->proc->fdtable, &fd, item->ifd))
+		return true;
+
+	bool closed = fd->node != item->vnode;
+
+	fd_release(fd);
+
+	return closed;
+
+}
+
+// takes up to max items off the ready list and reports what they have now.
+// level triggered items that still have events go back to the end of the list,
+// edge triggered ones wait for the next wakeup
+
+static int harvest(epoll_t* epoll, epoll_event* events, int max){
+
+	int count = 0;
+
+	spinlock_acquire(&epoll->ctllock);
+
+	// items put back are only looked at again on the next call
+
+	size_t left = __atomic_load_n(&epoll->readycount, __ATOMIC_RELAXED);
+
+	while(left-- && count < max){
+
+		bool intstate = arch_interrupt_save();
+		spinlock_acquire(&epoll->readylock);
+
+		epollitem* item = epoll->readyfirst;
+
+		if(item)
+			readyremove(epoll, item);
+
+		spinlock_release(&epoll->readylock);
+		arch_interrupt_restore(intstate);
+
+		if(!item)
+			break;
+
+		if(fdclosed(item)){
+			removeitem(epoll, item);
+			continue;
+		}
+
+		uint32_t ready = pollitem(item, NULL);
+
+		if(!ready)
+			continue;
+
+		events[count].events = ready;
+		events[count].data = item->data;
+		++count;
+
+		if(item->events & EPOLLONESHOT)
+			item->events &= EPOLLET | EPOLLONESHOT;
+		else if(!(item->events & EPOLLET))
+			markready(epoll, item);
+
+	}
+
+	spinlock_release(&epoll->ctllock);
+
+	return count;
+
+}
+
+typedef struct{
+	thread_t* thread;
+	bool timedout;
+} waitstate;
+
+static void* timeout(arch_regs* ctx, void* arg){
+	waitstate* state = arg;
+	state->timedout = true;
+	sched_eventsignal(NULL, state->thread);
+	return NULL;
+}
+
+int epoll_wait(epoll_t* epoll, epoll_event* events, int maxevents, int timeoutms, int* count){
+
+	waitstate state = {
+		.thread = arch_getcls()->thread
+	};
+	timer_req req = {
+		.func = timeout,
+		.argptr = &state
+	};
+	int err = 0;
+
+	if(timeoutms > 0)
+		timer_add(&req, (uint64_t)timeoutms * 1000, true);
+
+	for(;;){
+
+		*count = harvest(epoll, events, maxevents);
+
+		if(*count || timeoutms == 0 || state.timedout)
+			break;
+
+		// with the timer on this cpu and interrupts off it can't go off
+		// between the check and the thread blocking
+
+		arch_interrupt_disable();
+
+		if(timeoutms > 0)
+			timer_migrate(&req);
+
+		spinlock_acquire(&epoll->readylock);
+
+		if(epoll->readyfirst || state.timedout){
+			spinlock_release(&epoll->readylock);
+			arch_interrupt_enable();
+			continue;
+		}
+
+		err = event_waitlocked(&epoll->event, true, &epoll->readylock);
+
+		if(err)
+			break;
+
+	}
+
+	if(timeoutms > 0)
+		timer_remove(&req);
+
+	return err;
+
+}
+
+int epoll_poll(epoll_t* epoll, pollfd* fd, poll_table* table){
+
+	poll_wait(table, &epoll->event);
+
+	if((fd->events & POLLIN) && __atomic_load_n(&epoll->readycount, __ATOMIC_RELAXED))
+		fd->revents |= POLLIN;
+
+	return 0;
+
+}
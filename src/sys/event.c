@@ -3,68 +3,107 @@
 #include <arch/spinlock.h>
 #include <arch/cls.h>
 
-static bool addtoevent(thread_t* thread, event_t* event){
+// events can be signalled from interrupt handlers, so the lock is never
+// held with interrupts on
+
+void event_addwaiter(event_t* event, event_waiter* waiter, thread_t* thread){
 	
+	waiter->thread = thread;
+	waiter->next = NULL;
+
+	bool intstate = arch_interrupt_save();
 	spinlock_acquire(&event->lock);
 
-	uintmax_t i = 0;
+	waiter->prev = event->last;
+	waiter->queued = true;
+
+	if(event->last)
+		event->last->next = waiter;
+	else
+		event->first = waiter;
+
+	event->last = waiter;
 
-	for(; i < EVENT_MAX_THREADS; ++i){
-		if(!event->threads[i]){
-			event->threads[i] = arch_getcls()->thread;
-			break;
-		}
-	}
-	
 	spinlock_release(&event->lock);
+	arch_interrupt_restore(intstate);
 
-	return true;
+}
+
+// expects the event lock to be held
+
+static void unlink(event_t* event, event_waiter* waiter){
 	
+	if(waiter->prev)
+		waiter->prev->next = waiter->next;
+	else
+		event->first = waiter->next;
+
+	if(waiter->next)
+		waiter->next->prev = waiter->prev;
+	else
+		event->last = waiter->prev;
+
+	waiter->queued = false;
+
 }
 
-void removefromevent(thread_t* thread, event_t* event){
+// the waiter may already have been unlinked by whoever woke the thread
+
+void event_removewaiter(event_t* event, event_waiter* waiter){
+	
+	bool intstate = arch_interrupt_save();
 	spinlock_acquire(&event->lock);
 	
-	for(size_t i = 0; i < EVENT_MAX_THREADS; ++i){
-		if(event->threads[i] == thread){
-			event->threads[i] = NULL;
-			break;
-		}
-	}
+	if(waiter->queued)
+		unlink(event, waiter);
 	
 	spinlock_release(&event->lock);
+	arch_interrupt_restore(intstate);
+
 }
 
-int event_wait(event_t* event, bool interruptible){
+// lock (if not NULL) is released once the thread is on the event, so a signal
+// sent by someone holding it can't be missed
+
+int event_waitlocked(event_t* event, bool interruptible, int* lock){
 	
+	event_waiter waiter, sigwaiter;
+
+	waiter.wake = sigwaiter.wake = NULL;
 	
 	arch_interrupt_disable();
 
 	thread_t* thread = arch_getcls()->thread;
+	
+	// the state has to be set before the thread is visible to signalers
+	// on other cpus, otherwise the wakeup could be lost
+
+	sched_prepareblock(interruptible);
 
 	if(interruptible){
-		addtoevent(thread, &thread->sigevent);
+		event_addwaiter(&thread->sigevent, &sigwaiter, thread);
 	}
 
-	addtoevent(thread, event);
+	event_addwaiter(event, &waiter, thread);
 
-	
-	sched_block(interruptible);
+	if(lock)
+		spinlock_release(lock);
+
+	sched_yield();
 	
 	
 	int ret = 0;
 	
-	event_t* awokenby = thread->awokenby;
-
-	if(awokenby == &thread->sigevent){
+	if(thread->awokenby == &thread->sigevent)
 		ret = EINTR;
-		removefromevent(thread, awokenby);
-		awokenby = event;
-	}
 
-	removefromevent(thread, awokenby);
+	// the signaler holds the event lock while it touches the waiter,
+	// so the waiters can't go away from under it
 
-	spinlock_release(&event->lock);
+	if(interruptible)
+		event_removewaiter(&thread->sigevent, &sigwaiter);
+
+	event_removewaiter(event, &waiter);
 	
 	arch_interrupt_enable();
 
@@ -72,30 +111,55 @@ int event_wait(event_t* event, bool interruptible){
 
 }
 
-int event_signal(event_t* event, bool interruptson){
+int event_wait(event_t* event, bool interruptible){
+	return event_waitlocked(event, interruptible, NULL);
+}
+
+// wakes up to n waiters in the order they started waiting.
+// waiters that were already woken by something else don't count
+
+int event_signaln(event_t* event, size_t n, bool interruptson){
 	
 	if(interruptson)
 		arch_interrupt_disable();
 	
 	spinlock_acquire(&event->lock);
 	
-	
-	for(uintmax_t i = 0; i < EVENT_MAX_THREADS; ++i){
-		
-		thread_t* thread = event->threads[i];
+	int woken = 0;
+	event_waiter* waiter = event->first;
 
-		if(!thread)
-			continue;
-		
-		sched_eventsignal(event, thread);
+	// callbacks further down the list still have to see the signal
 
+	while(waiter){
 		
+		event_waiter* next = waiter->next;
+		
+		if(waiter->wake){
+			waiter->wake(waiter);
+		}
+		else if(woken < n){
+			unlink(event, waiter);
+			if(sched_eventsignal(event, waiter->thread))
+				++woken;
+		}
+
+		waiter = next;
+
 	}
 	
-	
 	spinlock_release(&event->lock);
 
 	if(interruptson)
 		arch_interrupt_enable();
 
+	return woken;
+
+}
+
+int event_signal(event_t* event, bool interruptson){
+	return event_signaln(event, ~(size_t)0, interruptson);
+}
+
+int event_signalone(event_t* event, bool interruptson){
+	return event_signaln(event, 1, interruptson);
 }
@@ -20,6 +20,7 @@ static uint32_t kblist;
 static keyboard_t keyboards[MAX_KEYBOARD_COUNT];
 
 static ringbuffer_t devbuff;
+static event_t devevent;
 
 void keyboard_packet(int kb, kbpacket_t packet){
 	
@@ -80,6 +81,7 @@ void keyboard_packet(int kb, kbpacket_t packet){
 	ringbuffer_write(&devbuff, &packet, sizeof(kbpacket_t));	
 	ringbuffer_write(&keyboards[kb].buffer, &packet, sizeof(kbpacket_t));
 	event_signal(&keyboards[kb].event, false);
+	event_signal(&devevent, false);
 }
 
 int keyboard_getandwait(int kb, kbpacket_t* buff){
@@ -145,7 +147,9 @@ static int read(int *error, int minor, void* buff, size_t count, size_t offset){
 
 }
 
-static int poll(int minor, pollfd* fd){
+static int poll(int minor, pollfd* fd, poll_table* table){
+
+	poll_wait(table, &devevent);
 
 	if((fd->events & POLLIN) && devbuff.read != devbuff.write)
 		fd->revents |= POLLIN;
@@ -0,0 +1,211 @@
+#include <kernel/lockstat.h>
+
+#ifdef LOCKSTAT
+
+#include <kernel/devman.h>
+#include <kernel/alloc.h>
+#include <arch/cls.h>
+#include <arch/tsc.h>
+#include <arch/interrupt.h>
+#include <arch/panic.h>
+#include <arch/timekeeper.h>
+#include <errno.h>
+#include <string.h>
+#include <stdio.h>
+
+// /dev/lockstat has a line per call site, most spin cycles first:
+// site acquires contended spincycles maxhold
+// times are in tsc cycles. the sites are kernel addresses, addr2line turns
+// them into source lines. writing anything to it clears the counters
+
+// the table is open addressed and never shrinks, sites that don't fit are
+// only counted in lost. nothing here can take a lock
+
+#define LOCKSTAT_SITES 1024
+#define STATLINE_MAX 128
+
+static lockstat_entry entries[LOCKSTAT_SITES];
+static size_t lost;
+
+static lockstat_entry* getentry(void* site){
+
+	size_t start = ((uintptr_t)site >> 2) % LOCKSTAT_SITES;
+
+	for(size_t i = 0; i < LOCKSTAT_SITES; ++i){
+		lockstat_entry* entry = &entries[(start + i) % LOCKSTAT_SITES];
+		void* current = __atomic_load_n(&entry->site, __ATOMIC_ACQUIRE);
+
+		if(current == NULL && __atomic_compare_exchange_n(&entry->site, &current, site, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+			return entry;
+
+		if(current == site)
+			return entry;
+	}
+
+	__atomic_add_fetch(&lost, 1, __ATOMIC_RELAXED);
+
+	return NULL;
+
+}
+
+void lockstat_acquired(void* site, void* lock, uint64_t spinstart, bool contended){
+
+	uint64_t now = rdtsc();
+	lockstat_entry* entry = getentry(site);
+
+	if(!entry)
+		return;
+
+	__atomic_add_fetch(&entry->acquires, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&entry->spincycles, now - spinstart, __ATOMIC_RELAXED);
+
+	if(contended)
+		__atomic_add_fetch(&entry->contended, 1, __ATOMIC_RELAXED);
+
+	// interrupt handlers take locks too, so the held list is changed with them off
+
+	bool intstate = arch_interrupt_save();
+	cls_t* cpu = arch_getcls();
+
+	if(cpu->lockstatdepth < LOCKSTAT_DEPTH){
+		lockstat_held* held = &cpu->lockstatheld[cpu->lockstatdepth++];
+		held->lock = lock;
+		held->entry = entry;
+		held->start = now;
+	}
+
+	arch_interrupt_restore(intstate);
+
+}
+
+// locks are mostly released in the reverse order they were taken in.
+// one that isn't found was taken on another cpu or didn't fit in the list
+
+void lockstat_released(void* lock){
+
+	uint64_t now = rdtsc();
+
+	bool intstate = arch_interrupt_save();
+	cls_t* cpu = arch_getcls();
+
+	for(size_t i = cpu->lockstatdepth; i > 0; --i){
+		lockstat_held* held = &cpu->lockstatheld[i - 1];
+
+		if(held->lock != lock)
+			continue;
+
+		uint64_t hold = now - held->start;
+		uint64_t max = __atomic_load_n(&held->entry->maxhold, __ATOMIC_RELAXED);
+
+		while(hold > max && !__atomic_compare_exchange_n(&held->entry->maxhold, &max, hold, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+		for(size_t j = i; j < cpu->lockstatdepth; ++j)
+			cpu->lockstatheld[j - 1] = cpu->lockstatheld[j];
+
+		--cpu->lockstatdepth;
+		break;
+	}
+
+	arch_interrupt_restore(intstate);
+
+}
+
+static char* stattext(size_t* len){
+
+	lockstat_entry** sorted = alloc(LOCKSTAT_SITES * sizeof(lockstat_entry*));
+	char* text = alloc(STATLINE_MAX * (LOCKSTAT_SITES + 1));
+
+	if(!sorted || !text){
+		free(sorted);
+		free(text);
+		return NULL;
+	}
+
+	size_t count = 0;
+
+	for(size_t i = 0; i < LOCKSTAT_SITES; ++i){
+		lockstat_entry* entry = &entries[i];
+
+		if(!entry->site)
+			continue;
+
+		size_t j = count++;
+
+		for(; j > 0 && sorted[j - 1]->spincycles < entry->spincycles; --j)
+			sorted[j] = sorted[j - 1];
+
+		sorted[j] = entry;
+	}
+
+	*len = sprintf(text, "tscperus %lu lost %lu\n", arch_timekeeper_tscperus(), lost);
+
+	for(size_t i = 0; i < count; ++i)
+		*len += sprintf(text + *len, "%p %lu %lu %lu %lu\n", sorted[i]->site, sorted[i]->acquires, sorted[i]->contended, sorted[i]->spincycles, sorted[i]->maxhold);
+
+	free(sorted);
+
+	return text;
+
+}
+
+static int read(int* error, int minor, void* buff, size_t count, size_t offset){
+
+	size_t len;
+	char* text = stattext(&len);
+
+	if(!text){
+		*error = ENOMEM;
+		return 0;
+	}
+
+	*error = 0;
+
+	if(offset >= len){
+		free(text);
+		return 0;
+	}
+
+	if(count > len - offset)
+		count = len - offset;
+
+	memcpy(buff, text + offset, count);
+
+	free(text);
+
+	return count;
+}
+
+// the sites stay, so a lookup racing with this still finds its entry
+
+static int write(int* error, int minor, void* buff, size_t count, size_t offset){
+
+	for(size_t i = 0; i < LOCKSTAT_SITES; ++i){
+		__atomic_store_n(&entries[i].acquires, 0, __ATOMIC_RELAXED);
+		__atomic_store_n(&entries[i].contended, 0, __ATOMIC_RELAXED);
+		__atomic_store_n(&entries[i].spincycles, 0, __ATOMIC_RELAXED);
+		__atomic_store_n(&entries[i].maxhold, 0, __ATOMIC_RELAXED);
+	}
+
+	__atomic_store_n(&lost, 0, __ATOMIC_RELAXED);
+
+	*error = 0;
+
+	return count;
+}
+
+static int isseekable(int minor, size_t* max){
+	*max = ~(size_t)0;
+	return 0;
+}
+
+static devcalls calls = {
+	read, write, NULL, isseekable
+};
+
+void lockstat_init(){
+	if(devman_newdevice("lockstat", TYPE_CHARDEV, MAJOR_LOCKSTAT, 0, &calls)){
+		_panic("/dev/lockstat init failed", NULL);
+	}
+}
+
+#endif
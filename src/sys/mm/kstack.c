@@ -0,0 +1,122 @@
+#include <kernel/kstack.h>
+#include <kernel/vmm.h>
+#include <kernel/pmm.h>
+#include <kernel/sched.h>
+#include <arch/mmu.h>
+#include <arch/cls.h>
+#include <arch/interrupt.h>
+
+// kernel stacks are virtually mapped with guard pages under them, so an overflow
+// faults instead of running into whatever is next in the hhdm.
+// the pages are mapped up front as the cpu can't take a page fault on a missing stack page
+
+static size_t pagecount(size_t size){
+	return size / PAGE_SIZE + (size % PAGE_SIZE ? 1 : 0);
+}
+
+static void release(void* base, size_t pagec){
+	
+	arch_mmu_tableptr context = arch_getcls()->context->context;
+
+	for(size_t page = 0; page < pagec; ++page){
+		void* addr = base + page*PAGE_SIZE;
+		void* paddr = arch_mmu_getphysicaladdr(context, addr);
+		if(!paddr)
+			continue;
+		arch_mmu_unmap(context, addr);
+		pmm_free(paddr, 1);
+	}
+
+	vmm_setfree(base - KSTACK_GUARD_PAGES*PAGE_SIZE, pagec + KSTACK_GUARD_PAGES);
+
+}
+
+static void* cachepop(){
+	
+	void* base = NULL;
+
+	bool enabled = arch_interrupt_save();
+
+	cls_t* cls = arch_getcls();
+
+	if(cls->kstackcachecount)
+		base = cls->kstackcache[--cls->kstackcachecount];
+	
+	arch_interrupt_restore(enabled);
+
+	return base;
+
+}
+
+static bool cachepush(void* base){
+	
+	bool pushed = false;
+
+	bool enabled = arch_interrupt_save();
+
+	cls_t* cls = arch_getcls();
+
+	if(cls->kstackcachecount < KSTACK_CACHE_SIZE){
+		cls->kstackcache[cls->kstackcachecount++] = base;
+		pushed = true;
+	}
+	
+	arch_interrupt_restore(enabled);
+
+	return pushed;
+
+}
+
+// returns the lowest address of the stack
+
+void* kstack_alloc(size_t size){
+	
+	size_t pagec = pagecount(size);
+
+	if(size == THREAD_DEFAULT_KSTACK_SIZE){
+		void* base = cachepop();
+		if(base)
+			return base;
+	}
+
+	void* guard = vmm_alloc(pagec + KSTACK_GUARD_PAGES, 0);
+
+	if(!guard)
+		return NULL;
+
+	void* base = guard + KSTACK_GUARD_PAGES*PAGE_SIZE;
+
+	if(!vmm_setused(base, pagec, ARCH_MMU_MAP_READ | ARCH_MMU_MAP_WRITE | ARCH_MMU_MAP_NOEXEC)){
+		vmm_setfree(guard, pagec + KSTACK_GUARD_PAGES);
+		return NULL;
+	}
+
+	arch_mmu_tableptr context = arch_getcls()->context->context;
+
+	for(size_t page = 0; page < pagec; ++page){
+		void* paddr = pmm_alloc(1);
+		if(!paddr || !arch_mmu_map(context, paddr, base + page*PAGE_SIZE, ARCH_MMU_MAP_READ | ARCH_MMU_MAP_WRITE | ARCH_MMU_MAP_NOEXEC)){
+			if(paddr)
+				pmm_free(paddr, 1);
+			release(base, pagec);
+			return NULL;
+		}
+	}
+
+	return base;
+
+}
+
+// must be called with interrupts enabled, unmapping may need a tlb shootdown
+
+void kstack_free(void* base, size_t size){
+	
+	if(!base)
+		return;
+
+	if(size == THREAD_DEFAULT_KSTACK_SIZE && cachepush(base))
+		return;
+
+	release(base, pagecount(size));
+
+}
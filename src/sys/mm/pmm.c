@@ -29,7 +29,8 @@ size_t usablememsize = 0;
 size_t totalmemsize  = 0;
 void* lastfree = PAGE_SIZE;
 void* pmm_usabletop;
-int lock = 0;
+// every cpu goes through here, the waiters spin on their own node
+mcslock_t lock;
 
 static int getstate(void* addr){
 	if(addr >= limine_hhdm_offset) addr -= limine_hhdm_offset;
@@ -70,31 +71,34 @@ static void setstate(void* addr, size_t state){
 
 void pmm_setused(void* addr, size_t count){
 	if(count == 0) return;
-	spinlock_acquire(&lock);
+	mcsnode_t node;
+	mcslock_acquire(&lock, &node);
 	
 	for(size_t i = 0; i < count; ++i)	
 		setstate(addr + PAGE_SIZE*i, STATE_USED);
 
-	spinlock_release(&lock);
+	mcslock_release(&lock, &node);
 }
 
 void pmm_free(void* addr, size_t count){
 	if(count == 0) return;
-	spinlock_acquire(&lock);
+	mcsnode_t node;
+	mcslock_acquire(&lock, &node);
 	
 	for(size_t i = 0; i < count; ++i)	
 		setstate(addr + PAGE_SIZE*i, STATE_FREE);
 	
 	lastfree = addr < lastfree ? addr : lastfree;
 
-	spinlock_release(&lock);
+	mcslock_release(&lock, &node);
 }
 
 
 
 void* pmm_alloc(size_t count){
 	if(count == 0) return NULL;
-	spinlock_acquire(&lock);
+	mcsnode_t node;
+	mcslock_acquire(&lock, &node);
 	
 	void* addr = lastfree;
 	
@@ -124,14 +128,14 @@ void* pmm_alloc(size_t count){
 	
 
 	if(addr >= bitmaptop){
-		spinlock_release(&lock);
+		mcslock_release(&lock, &node);
 		return NULL;
 	}
 	
 	for(size_t i = 0; i < count; ++i) setstate(addr + i * PAGE_SIZE, STATE_USED);
 
 
-	spinlock_release(&lock);
+	mcslock_release(&lock, &node);
 	
 	if(count == 1)
 		lastfree = addr;
@@ -5,6 +5,9 @@
 #include <stddef.h>
 #include <stdint.h>
 #include <string.h>
+#include <arch/cls.h>
+#include <arch/interrupt.h>
+#include <arch/panic.h>
 
 #define SLAB_SIZE PAGE_SIZE
 
@@ -190,3 +193,104 @@ void slab_init(){
 		
 	}
 }
+
+// typed caches
+// free objects are linked through their first word, the per cpu lists are
+// refilled from and flushed to the shared list half at a time
+
+static int cachecount;
+
+void slab_cacheinit(slab_cache* cache, size_t size, void (*ctor)(void*)){
+	
+	cache->id = __atomic_fetch_add(&cachecount, 1, __ATOMIC_SEQ_CST);
+
+	if(cache->id >= SLAB_MAXCACHES)
+		_panic("Too many slab caches", 0);
+
+	if(size < sizeof(void*))
+		size = sizeof(void*);
+
+	cache->lock = 0;
+	cache->size = (size + 15) & ~(size_t)15;
+	cache->ctor = ctor;
+	cache->freelist = NULL;
+
+}
+
+// expects the cache lock to be held
+
+static bool cachegrow(slab_cache* cache){
+	
+	size_t pagec = (cache->size * SLAB_CACHE_MINOBJS + PAGE_SIZE - 1) / PAGE_SIZE;
+	void* chunk = pmm_hhdmalloc(pagec);
+
+	if(!chunk)
+		return false;
+
+	for(void* obj = chunk; obj + cache->size <= chunk + pagec*PAGE_SIZE; obj += cache->size){
+		*(void**)obj = cache->freelist;
+		cache->freelist = obj;
+	}
+
+	return true;
+
+}
+
+void* slab_cachealloc(slab_cache* cache){
+	
+	bool enabled = arch_interrupt_save();
+
+	slab_cpucache* cpucache = &arch_getcls()->slabcaches[cache->id];
+
+	if(cpucache->count == 0){
+		spinlock_acquire(&cache->lock);
+		while(cpucache->count < SLAB_CPUCACHE_SIZE / 2){
+			if(!cache->freelist && !cachegrow(cache))
+				break;
+			void* obj = cache->freelist;
+			cache->freelist = *(void**)obj;
+			cpucache->objs[cpucache->count++] = obj;
+		}
+		spinlock_release(&cache->lock);
+	}
+
+	void* obj = cpucache->count ? cpucache->objs[--cpucache->count] : NULL;
+
+	arch_interrupt_restore(enabled);
+
+	if(!obj)
+		return NULL;
+
+	if(cache->ctor)
+		cache->ctor(obj);
+	else
+		memset(obj, 0, cache->size);
+
+	return obj;
+
+}
+
+void slab_cachefree(slab_cache* cache, void* obj){
+	
+	if(!obj)
+		return;
+
+	bool enabled = arch_interrupt_save();
+
+	slab_cpucache* cpucache = &arch_getcls()->slabcaches[cache->id];
+
+	if(cpucache->count == SLAB_CPUCACHE_SIZE){
+		spinlock_acquire(&cache->lock);
+		while(cpucache->count > SLAB_CPUCACHE_SIZE / 2){
+			void* old = cpucache->objs[--cpucache->count];
+			*(void**)old = cache->freelist;
+			cache->freelist = old;
+		}
+		spinlock_release(&cache->lock);
+	}
+
+	cpucache->objs[cpucache->count++] = obj;
+
+	arch_interrupt_restore(enabled);
+
+}
@@ -342,6 +342,11 @@ static bool unmap(vmm_mapping** mapstart, void* addr, size_t pagec){
 				void* paddr = arch_mmu_getphysicaladdr(context, addr);
 				pmm_free(paddr, 1);
 				arch_mmu_unmap(context, addr);
+				break;
+
+			case VMM_TYPE_SHARED:
+				if(arch_mmu_ismapped(context, addr))
+					arch_mmu_unmap(context, addr);
 
 			default:
 				continue;
@@ -381,6 +386,14 @@ void vmm_destroy(vmm_context* ctx){
 		vmm_mapping* old = mapping;
 		mapping = mapping->next;
 
+		// destroying the tables would free the pages too
+
+		if(old->type == VMM_TYPE_SHARED){
+			for(void* addr = old->start; addr < old->end; addr += PAGE_SIZE)
+				if(arch_mmu_ismapped(ctx->context, addr))
+					arch_mmu_unmap(ctx->context, addr);
+		}
+
                 freeentry(old);
 
 	}
@@ -411,10 +424,24 @@ int vmm_fork(vmm_context* oldctx, vmm_context* newctx){
 		
 		
 		if(mapping->type == VMM_TYPE_FILE)
-			++((vnode_t*)mapping->data)->refcount;
+			vfs_acquirenode(mapping->data);
 		
 
 
+		// the same pages are mapped in both
+
+		if(mapping->type == VMM_TYPE_SHARED){
+			for(uintmax_t page = 0; page < pagesize; ++page){
+				void* pageaddr = mapping->start + page*PAGE_SIZE;
+
+				if(arch_mmu_ismapped(oldctx->context, pageaddr) == false)
+					continue;
+
+				if(!arch_mmu_map(newctx->context, arch_mmu_getphysicaladdr(oldctx->context, pageaddr), pageaddr, mapping->mmuflags))
+					goto _fail;
+			}
+		}
+
 		if(mapping->type == VMM_TYPE_ANON){
 			
 			
@@ -597,6 +624,32 @@ bool vmm_map(void* paddr, void* vaddr, size_t pagec, size_t mmuflags){
 	return result;
 }
 
+// maps pages the kernel keeps ownership of, they stay allocated when unmapped
+
+bool vmm_mapshared(void* paddr, void* vaddr, size_t pagec, size_t mmuflags){
+	int* lock;
+	vmm_mapping** start;
+	
+	getcontextinfo(vaddr, &lock, &start);
+
+	spinlock_acquire(lock);
+
+	vmm_mapping* m = findmappingfromaddr(*start, vaddr);
+
+	if(m->type != VMM_TYPE_FREE || (vaddr + pagec*PAGE_SIZE-1) > m->end){
+		spinlock_release(lock);
+		return false;
+	}
+
+	bool result = setmap(start, vaddr, pagec, mmuflags, VMM_TYPE_SHARED, 0, 0);
+
+	for(size_t page = 0; page < pagec && result; ++page)
+		result = arch_mmu_map(arch_getcls()->context->context, paddr + page*PAGE_SIZE, vaddr + page*PAGE_SIZE, mmuflags);
+
+	spinlock_release(lock);
+	return result;
+}
+
 bool vmm_allocnowat(void* addr, size_t mmuflags, size_t size){
 	int* lock;
 	vmm_mapping** start;
@@ -10,11 +10,13 @@ static int mouseinuse;
 
 mouse_t mouse[MOUSE_COUNT];
 ringbuffer_t devbuffer;
+static event_t devevent;
 
 void mouse_packet(int id, mousepacket_t packet){
 	ringbuffer_write(&devbuffer, &packet, sizeof(mousepacket_t));
 	ringbuffer_write(&mouse[id].buffer, &packet, sizeof(mousepacket_t));
 	event_signal(&mouse[id].event, false);
+	event_signal(&devevent, false);
 }
 
 int mouse_getnew(){
@@ -52,7 +54,9 @@ static int read(int *error, int minor, void* buff, size_t count, size_t offset){
 
 }
 
-static int poll(int minor, pollfd* fd){
+static int poll(int minor, pollfd* fd, poll_table* table){
+
+        poll_wait(table, &devevent);
 
         if((fd->events & POLLIN) && devbuffer.read != devbuffer.write)
                 fd->revents |= POLLIN;
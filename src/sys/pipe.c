@@ -17,6 +17,18 @@ pipe_t* pipe_create(size_t buffsize){
 	return pipe;
 }
 
+// readers sleep on wevent and writers on revent. only one of them is woken per
+// read or write and it passes the wakeup on if there is still something left for
+// the others, hangups wake everyone
+
+static inline bool hasdata(pipe_t* pipe){
+	return pipe->buff.write != pipe->buff.read;
+}
+
+static inline bool hasspace(pipe_t* pipe){
+	return pipe->buff.write != pipe->buff.read + pipe->buff.size;
+}
+
 int pipe_read(pipe_t* pipe, void* buff, size_t count, int* error){
 	
 	spinlock_acquire(&pipe->lock);
@@ -32,7 +44,9 @@ int pipe_read(pipe_t* pipe, void* buff, size_t count, int* error){
 
 		if(readc > 0){
 			arch_interrupt_enable();
-			event_signal(&pipe->revent, true);
+			event_signalone(&pipe->revent, true);
+			if(hasdata(pipe))
+				event_signalone(&pipe->wevent, true);
 			break;
 		}
 			
@@ -45,6 +59,8 @@ int pipe_read(pipe_t* pipe, void* buff, size_t count, int* error){
 			spinlock_acquire(&pipe->lock);
 			readc = -1;
 			*error = EINTR;
+			if(hasdata(pipe))
+				event_signalone(&pipe->wevent, true);
 			break;
 		}
 	
@@ -73,7 +89,9 @@ int pipe_write(pipe_t* pipe, void* buff, size_t count, int* error){
 		writec = ringbuffer_write(&pipe->buff, buff, count);
 
 		if(writec > 0){
-			event_signal(&pipe->wevent, true);
+			event_signalone(&pipe->wevent, true);
+			if(hasspace(pipe))
+				event_signalone(&pipe->revent, true);
 			break;
 		}
 		
@@ -84,6 +102,8 @@ int pipe_write(pipe_t* pipe, void* buff, size_t count, int* error){
 			spinlock_acquire(&pipe->lock);
 			*error = EINTR;
 			writec = -1;
+			if(hasspace(pipe))
+				event_signalone(&pipe->revent, true);
 			break;
 		}
 		spinlock_acquire(&pipe->lock);
@@ -99,22 +119,26 @@ int pipe_write(pipe_t* pipe, void* buff, size_t count, int* error){
 	return writec;
 }
 
-int pipe_poll(pipe_t* pipe, pollfd* fd){
+int pipe_poll(pipe_t* pipe, pollfd* fd, poll_table* table){
 	
 	spinlock_acquire(&pipe->lock);
 
 	if(fd->events & POLLIN){ // fd is reading
+		poll_wait(table, &pipe->wevent);
+
 		if(pipe->writers == 0)
 			fd->revents |= POLLHUP;
 		
-		if(pipe->buff.write != pipe->buff.read)
+		if(hasdata(pipe))
 			fd->revents |= POLLIN;
 
 	}
 	else { // fd is writing
+		poll_wait(table, &pipe->revent);
+
 		if(pipe->readers == 0)
 			fd->revents |= POLLERR;
-		else if(pipe->buff.write != pipe->buff.read + pipe->buff.size)
+		else if(hasspace(pipe))
 			fd->revents |= POLLOUT;
 			
 
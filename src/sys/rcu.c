@@ -0,0 +1,63 @@
+#include <kernel/rcu.h>
+#include <arch/cls.h>
+#include <arch/smp.h>
+#include <arch/spinlock.h>
+
+// every cpu publishes the epoch its outermost read side started in, or 0
+// when it isn't in one. a writer moves the epoch forward and waits for the
+// cpus still in an older one
+
+static uint64_t epoch = 1;
+
+void rcu_readlock(){
+	
+	preempt_disable();
+
+	cls_t* cpu = arch_getcls();
+
+	if(cpu->rcunesting++)
+		return;
+
+	// the reads that follow can't be done before the epoch is visible
+
+	__atomic_store_n(&cpu->rcuepoch, __atomic_load_n(&epoch, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+}
+
+void rcu_readunlock(){
+	
+	cls_t* cpu = arch_getcls();
+
+	if(--cpu->rcunesting == 0)
+		__atomic_store_n(&cpu->rcuepoch, 0, __ATOMIC_RELEASE);
+
+	preempt_enable();
+
+}
+
+static void waitfor(cls_t* cpu, uint64_t current){
+
+	uint64_t cpuepoch;
+
+	while((cpuepoch = __atomic_load_n(&cpu->rcuepoch, __ATOMIC_ACQUIRE)) && cpuepoch < current)
+		asm volatile("pause");
+
+}
+
+void rcu_synchronize(){
+	
+	uint64_t current = __atomic_add_fetch(&epoch, 1, __ATOMIC_SEQ_CST);
+	size_t cpucount = arch_smp_cpucount();
+
+	// before smp_init there is only this cpu
+
+	if(cpucount == 0){
+		waitfor(arch_getcls(), current);
+		return;
+	}
+
+	for(size_t i = 0; i < cpucount; ++i)
+		waitfor(arch_smp_getcls(i), current);
+
+}
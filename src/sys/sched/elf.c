@@ -5,6 +5,7 @@
 #include <string.h>
 #include <arch/cls.h>
 #include <arch/elfmagic.h>
+#include <arch/vdso.h>
 
 static size_t phflagtommuflag(size_t phflags){
 	
@@ -180,6 +181,7 @@ int elf_load(thread_t* thread, vnode_t* node, char** argv, char** env, void** st
 	auxv.phnum.a_type = AT_PHNUM;
 	auxv.phent.a_type = AT_PHENT;
 	auxv.entry.a_type = AT_ENTRY;
+	auxv.sysinfoehdr.a_type = AT_SYSINFO_EHDR;
 	
 	auxv.phnum.a_val = header.ph_count;
 	auxv.phent.a_val = header.ph_size;
@@ -262,6 +264,11 @@ int elf_load(thread_t* thread, vnode_t* node, char** argv, char** env, void** st
 
 	}
 
+	err = arch_vdso_map(thread->proc, &auxv.sysinfoehdr.a_val);
+
+	if(err)
+		return err;
+
 	*stack = stacksetup(argv, env, auxv);
 	
 	if(!(*stack))
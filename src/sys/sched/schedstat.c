@@ -0,0 +1,139 @@
+#include <kernel/devman.h>
+#include <kernel/sched.h>
+#include <kernel/alloc.h>
+#include <arch/cls.h>
+#include <arch/smp.h>
+#include <arch/panic.h>
+#include <arch/timekeeper.h>
+#include <arch/spinlock.h>
+#include <errno.h>
+#include <string.h>
+#include <stdio.h>
+
+// /dev/schedstat (minor 0) has the per cpu counters and histograms,
+// /dev/threadstat (minor 1) the counters of the threads of the reading process.
+// the whole text is regenerated on every read and the offset is applied to it
+// times are in milliseconds, busy time per cpu is uptime - idletime.
+// histogram bucket 0 counts times under 1us, bucket n times in [2^(n-1), 2^n) us
+
+#define STATLINE_MAX 256
+#define STATCPU_MAX (STATLINE_MAX + SCHED_HISTSIZE * 24 * 2)
+
+static size_t printhist(char* buff, char* name, size_t* hist){
+	
+	size_t len = sprintf(buff, "  %s", name);
+
+	for(size_t i = 0; i < SCHED_HISTSIZE; ++i)
+		len += sprintf(buff + len, " %lu", hist[i]);
+
+	len += sprintf(buff + len, "\n");
+
+	return len;
+}
+
+static size_t printcpu(char* buff, cls_t* cpu){
+	
+	size_t len = sprintf(buff, "cpu%lu queued %lu steals %lu migrations %lu idleentries %lu idletime %lu voluntary %lu involuntary %lu rtthrottles %lu\n", cpu->cpunum, cpu->queuedthreads, cpu->steals, cpu->migrations, cpu->idleentries, cpu->idletime / 1000000, cpu->voluntary, cpu->involuntary, cpu->rtthrottles);
+
+	len += printhist(buff + len, "latency", cpu->latencyhist);
+	len += printhist(buff + len, "runtime", cpu->runtimehist);
+
+	return len;
+}
+
+static char* schedtext(size_t* len){
+	
+	size_t cpucount = arch_smp_cpucount();
+	char* text = alloc(STATLINE_MAX + STATCPU_MAX * cpucount);
+
+	if(!text)
+		return NULL;
+
+	struct timespec uptime = arch_timekeeper_gettimefromboot();
+
+	*len = sprintf(text, "uptime %lu\nclocksource %s\n", uptime.tv_sec * 1000 + uptime.tv_nsec / 1000000, arch_timekeeper_source());
+
+	for(size_t i = 0; i < cpucount; ++i)
+		*len += printcpu(text + *len, arch_smp_getcls(i));
+
+	return text;
+}
+
+// runtime and wait times in microseconds
+
+static char* threadtext(size_t* len){
+	
+	proc_t* proc = arch_getcls()->thread->proc;
+
+	spinlock_acquire(&proc->lock);
+
+	char* text = alloc(STATLINE_MAX * (proc->threadcount + 1));
+
+	if(!text){
+		spinlock_release(&proc->lock);
+		return NULL;
+	}
+
+	*len = 0;
+
+	for(size_t i = 0; i < proc->threadcount; ++i){
+		thread_t* thread = proc->threads[i];
+		if(thread->state == THREAD_STATE_DEAD)
+			continue;
+		*len += sprintf(text + *len, "tid %d runtime %lu waittime %lu maxlatency %lu voluntary %lu involuntary %lu policy %d rtpriority %d\n", thread->tid, thread->runtime / 1000, thread->waittime / 1000, thread->maxlatency / 1000, thread->voluntary, thread->involuntary, thread->policy, thread->rtpriority);
+	}
+
+	spinlock_release(&proc->lock);
+
+	return text;
+}
+
+static int read(int* error, int minor, void* buff, size_t count, size_t offset){
+
+	size_t len;
+	char* text = minor ? threadtext(&len) : schedtext(&len);
+
+	if(!text){
+		*error = ENOMEM;
+		return 0;
+	}
+
+	*error = 0;
+
+	if(offset >= len){
+		free(text);
+		return 0;
+	}
+
+	if(count > len - offset)
+		count = len - offset;
+
+	memcpy(buff, text + offset, count);
+
+	free(text);
+
+	return count;
+}
+
+static int write(int* error, int minor, void* buff, size_t count, size_t offset){
+	*error = EPERM;
+	return 0;
+}
+
+static int isseekable(int minor, size_t* max){
+	*max = ~(size_t)0;
+	return 0;
+}
+
+static devcalls calls = {
+	read, write, NULL, isseekable
+};
+
+void schedstat_init(){
+	if(devman_newdevice("schedstat", TYPE_CHARDEV, MAJOR_SCHEDSTAT, 0, &calls)){
+		_panic("/dev/schedstat init failed", NULL);
+	}
+	if(devman_newdevice("threadstat", TYPE_CHARDEV, MAJOR_SCHEDSTAT, 1, &calls)){
+		_panic("/dev/threadstat init failed", NULL);
+	}
+}
@@ -1,58 +1,107 @@
 #include <kernel/sched.h>
+#include <kernel/kstack.h>
 #include <arch/cls.h>
 #include <kernel/sched.h>
 #include <arch/spinlock.h>
 #include <kernel/alloc.h>
+#include <kernel/slab.h>
 #include <arch/mmu.h>
 #include <kernel/pmm.h>
 #include <kernel/timer.h>
 #include <string.h>
 #include <kernel/elf.h>
 #include <arch/interrupt.h>
+#include <arch/smp.h>
+#include <arch/cpu.h>
+#include <kernel/env.h>
+#include <arch/timekeeper.h>
+#include <errno.h>
 
 #define THREAD_QUANTUM 10000
 
-// queue 0: interrupt threads
-// queue 1: kernel threads
-// queue 2: user threads
+// user threads are served by vruntime instead of round robin.
+// vruntime advances by the time spent running scaled by the nice weight,
+// and the thread with the lowest one runs next
 
-#define QUEUE_COUNT 3
+#define NICE_0_WEIGHT 1024
 
-sched_queue queues[QUEUE_COUNT];
+// a woken thread is placed at most this far (ns) behind the cpu's min vruntime
+#define SLEEPER_CREDIT (THREAD_QUANTUM * 1000 / 2)
+
+static const unsigned int niceweights[SCHED_NICE_MAX - SCHED_NICE_MIN + 1] = {
+	88761, 71755, 56483, 46273, 36291,
+	29154, 23254, 18705, 14949, 11916,
+	9548, 7620, 6100, 4904, 3906,
+	3121, 2501, 1991, 1586, 1277,
+	1024, 820, 655, 526, 423,
+	335, 272, 215, 172, 137,
+	110, 87, 70, 56, 45,
+	36, 29, 23, 18, 15
+};
+
+// real time threads run before every user thread, highest priority first.
+// fifo threads keep the cpu until they block or something above them is queued,
+// rr threads also hand it to their equals after every slice.
+// they only get RT_RUNTIME ns of every RT_PERIOD on a cpu, after that the
+// real time queue is skipped there until the period is over
+
+#define RR_TIMESLICE 100000000ul
+#define RT_PERIOD 1000000000ul
+#define RT_RUNTIME 950000000ul
 
 // XXX allocate these in a better way
 
-static int pidlock;
+static ticketlock_t pidlock;
 static pid_t nextpid = 1;
 static proc_t* init;
 
+// with nohz the quantum only runs while other threads are waiting for a cpu
+// and idle cpus only wake up for real timer requests.
+// "periodictick" in the command line turns it off
+
+static bool nohz;
+
 proc_t* sched_getinit(){
 	return init;
 }
 
 static int getnextpid(){
-	spinlock_acquire(&pidlock);
+	ticketlock_acquire(&pidlock);
 	int pid = nextpid++;
-	spinlock_release(&pidlock);
+	ticketlock_release(&pidlock);
 	return pid;
 }
 
+// the structures created for every thread and process come from their own caches
+
+static slab_cache threadcache;
+static slab_cache proccache;
+static slab_cache regscache;
+
+static void threadctor(void* obj){
+	thread_t* thread = obj;
+	memset(thread, 0, sizeof(thread_t));
+	thread->lastcpu = -1;
+	thread->queuedcpu = -1;
+	cpuset_fill(&thread->affinity);
+}
+
 static proc_t* allocproc(size_t threadcount){
 	
-	proc_t* proc = alloc(sizeof(proc_t));
+	proc_t* proc = slab_cachealloc(&proccache);
 	if(!proc)
 		return NULL;
 
 	proc->threads = alloc(sizeof(thread_t*) * threadcount);
 
 	if(!proc->threads){
-		free(proc);
+		slab_cachefree(&proccache, proc);
 		return NULL;
 	}
 
 	if(fd_tableinit(&proc->fdtable)){
 		free(proc->threads);
-		free(proc);
+		slab_cachefree(&proccache, proc);
 		return NULL;
 	}
 
@@ -64,26 +113,27 @@ static proc_t* allocproc(size_t threadcount){
 
 static thread_t* allocthread(proc_t* proc, state_t state, pid_t tid, size_t kstacksize){
 	
-	thread_t* thread = alloc(sizeof(thread_t));
+	thread_t* thread = slab_cachealloc(&threadcache);
 	
 	if(!thread)
 		return NULL;
 
 
-	thread->regs = alloc(sizeof(arch_regs));
+	thread->regs = slab_cachealloc(&regscache);
 	
 	if(!thread->regs){
-		free(thread);
+		slab_cachefree(&threadcache, thread);
 		return NULL;
 	}
 
-	
-	thread->kernelstackbase = alloc(kstacksize);
+	// a 0 sized stack is only used for the boot contexts, which already have one
+
+	thread->kernelstackbase = kstacksize ? kstack_alloc(kstacksize) : NULL;
 
 
-	if(!thread->kernelstackbase){
-		free(thread->regs);
-		free(thread);
+	if(kstacksize && !thread->kernelstackbase){
+		slab_cachefree(&regscache, thread->regs);
+		slab_cachefree(&threadcache, thread);
 		return NULL;
 	}
 
@@ -91,9 +141,9 @@ static thread_t* allocthread(proc_t* proc, state_t state, pid_t tid, size_t ksta
 	thread->ctx = vmm_newcontext();
 
 	if(!thread->ctx){
-		free(thread->kernelstackbase);
-		free(thread->regs);
-		free(thread);
+		kstack_free(thread->kernelstackbase, kstacksize);
+		slab_cachefree(&regscache, thread->regs);
+		slab_cachefree(&threadcache, thread);
 		return NULL;
 	}
 
@@ -102,89 +152,774 @@ static thread_t* allocthread(proc_t* proc, state_t state, pid_t tid, size_t ksta
 	thread->tid = tid;
 	thread->kernelstack = thread->kernelstackbase + kstacksize;
 	thread->stacksize = kstacksize;
+	thread->preemptcount = 0;
 	
-	arch_regs_firsttimesetup(thread->regs, &thread->extraregs);
+	if(arch_regs_firsttimesetup(thread->regs, &thread->extraregs)){
+		vmm_destroy(thread->ctx);
+		kstack_free(thread->kernelstackbase, kstacksize);
+		slab_cachefree(&regscache, thread->regs);
+		slab_cachefree(&threadcache, thread);
+		return NULL;
+	}
 
 	return thread;
 
 }
 
-static thread_t* freethread(thread_t* thread){
-	free(thread->regs);
-	free(thread->kernelstack);
-	free(thread);
+void sched_freethread(thread_t* thread){
+	arch_regs_freeextra(&thread->extraregs);
+	slab_cachefree(&regscache, thread->regs);
+	kstack_free(thread->kernelstackbase, thread->stacksize);
+	slab_cachefree(&threadcache, thread);
 }
 
-static void queue_add(sched_queue* queue, thread_t* thread){
+void sched_freeproc(proc_t* proc){
+	slab_cachefree(&proccache, proc);
+}
+
+static uint64_t now(){
+	return arch_timekeeper_nsfromboot();
+}
+
+static int vruntimecmp(rbnode_t* a, rbnode_t* b){
+	thread_t* ta = RBTREE_ENTRY(a, thread_t, fairnode);
+	thread_t* tb = RBTREE_ENTRY(b, thread_t, fairnode);
+	
+	if(ta->vruntime == tb->vruntime)
+		return 0;
+
+	return ta->vruntime < tb->vruntime ? -1 : 1;
+}
+
+static void list_add(thread_t** start, thread_t** end, thread_t* thread, bool front){
+	
+	if(front){
+		thread->prev = NULL;
+		thread->next = *start;
+		if(*start)
+			(*start)->prev = thread;
+		else
+			*end = thread;
+		*start = thread;
+		return;
+	}
+
 	thread->next = NULL;
-	thread->prev = queue->end;
-	if(queue->end)
-		queue->end->next = thread;
-	queue->end = thread;
-	if(!queue->start)
-		queue->start = thread;
+	thread->prev = *end;
+	if(*end)
+		(*end)->next = thread;
+	*end = thread;
+	if(!*start)
+		*start = thread;
 
 }
 
-static void queue_remove(sched_queue* queue, thread_t* thread){	
+static void list_remove(thread_t** start, thread_t** end, thread_t* thread){
 
 	if(thread->next)
 		thread->next->prev = thread->prev;
 	else
-		queue->end = thread->prev;
+		*end = thread->prev;
 
 	if(thread->prev)
 		thread->prev->next = thread->next;
 	else
-		queue->start = thread->next;
+		*start = thread->next;
 
 }
 
-static thread_t* getnext(){
+// highest real time priority under limit with threads queued, 0 if there is none
+
+static int rt_highest(sched_rtlists* rt, int limit){
+	
+	int top = (limit - 1) / 64;
+
+	for(int word = top; word >= 0; --word){
+		uint64_t bits = __atomic_load_n(&rt->bitmap[word], __ATOMIC_SEQ_CST);
+		if(word == top && limit % 64)
+			bits &= ((uint64_t)1 << (limit % 64)) - 1;
+		if(bits)
+			return word * 64 + 63 - __builtin_clzl(bits);
+	}
+
+	return 0;
+}
+
+static thread_t* queue_first(sched_queue* queue){
+	if(queue->fair)
+		return queue->tree.first ? RBTREE_ENTRY(queue->tree.first, thread_t, fairnode) : NULL;
+	if(queue->rt){
+		int prio = rt_highest(queue->rt, SCHED_RTPRIO_MAX + 1);
+		return prio ? queue->rt->lists[prio].start : NULL;
+	}
+	return queue->start;
+}
+
+static thread_t* queue_next(sched_queue* queue, thread_t* thread){
+	if(queue->fair){
+		rbnode_t* next = rbtree_next(&thread->fairnode);
+		return next ? RBTREE_ENTRY(next, thread_t, fairnode) : NULL;
+	}
+	if(queue->rt && !thread->next){
+		int prio = rt_highest(queue->rt, thread->rtlist);
+		return prio ? queue->rt->lists[prio].start : NULL;
+	}
+	return thread->next;
+}
+
+// can be called without the lock held
+
+static bool queue_hasthreads(sched_queue* queue){
+	if(queue->fair)
+		return __atomic_load_n(&queue->tree.first, __ATOMIC_SEQ_CST);
+	if(queue->rt)
+		return rt_highest(queue->rt, SCHED_RTPRIO_MAX + 1);
+	return __atomic_load_n(&queue->start, __ATOMIC_SEQ_CST);
+}
+
+// a real time thread that was preempted goes back to the front of its list
+
+static void queue_add(sched_queue* queue, thread_t* thread){
+	
+	if(queue->fair){
+		rbtree_insert(&queue->tree, &thread->fairnode);
+		return;
+	}
+
+	if(queue->rt){
+		// the priority can change while the thread is queued
+		thread->rtlist = thread->rtpriority;
+		sched_list* list = &queue->rt->lists[thread->rtlist];
+		list_add(&list->start, &list->end, thread, thread->rtfront);
+		thread->rtfront = false;
+		__atomic_or_fetch(&queue->rt->bitmap[thread->rtlist / 64], (uint64_t)1 << (thread->rtlist % 64), __ATOMIC_SEQ_CST);
+		return;
+	}
+
+	list_add(&queue->start, &queue->end, thread, false);
+
+}
+
+static void queue_remove(sched_queue* queue, thread_t* thread){	
+	
+	if(queue->fair){
+		rbtree_remove(&queue->tree, &thread->fairnode);
+		return;
+	}
+
+	if(queue->rt){
+		sched_list* list = &queue->rt->lists[thread->rtlist];
+		list_remove(&list->start, &list->end, thread);
+		if(!list->start)
+			__atomic_and_fetch(&queue->rt->bitmap[thread->rtlist / 64], ~((uint64_t)1 << (thread->rtlist % 64)), __ATOMIC_SEQ_CST);
+		return;
+	}
+
+	list_remove(&queue->start, &queue->end, thread);
+
+}
+
+// starts a new real time period if the last one is over
+
+static void rt_refresh(cls_t* cpu, uint64_t time){
+	if(time - cpu->rtperiodstart < RT_PERIOD)
+		return;
+	cpu->rtperiodstart = time;
+	cpu->rtruntime = 0;
+	cpu->rtthrottled = false;
+}
+
+static void rt_charge(cls_t* cpu, thread_t* thread, uint64_t time, uint64_t delta){
+	
+	rt_refresh(cpu, time);
+
+	cpu->rtruntime += delta;
+
+	if(!cpu->rtthrottled && cpu->rtruntime >= RT_RUNTIME){
+		cpu->rtthrottled = true;
+		++cpu->rtthrottles;
+	}
+
+	if(thread->policy == SCHED_RR)
+		thread->rrslice = delta < thread->rrslice ? thread->rrslice - delta : 0;
+
+}
+
+// true if a real time thread queued on the cpu should run before the running thread
+
+static bool rt_waiting(cls_t* cpu){
+	
+	thread_t* current = cpu->thread;
+
+	if(current == cpu->idlethread || current->priority < THREAD_PRIORITY_REALTIME || cpu->rtthrottled)
+		return false;
+
+	int prio = rt_highest(cpu->queues[THREAD_PRIORITY_REALTIME].rt, SCHED_RTPRIO_MAX + 1);
+
+	if(!prio)
+		return false;
+
+	return current->priority != THREAD_PRIORITY_REALTIME || prio > current->rtpriority;
+
+}
+
+// true if this cpu has something queued or could steal something
+
+static bool anyqueued(){
+	
+	size_t cpucount = arch_smp_cpucount();
+
+	if(cpucount == 0)
+		return __atomic_load_n(&arch_getcls()->queuedthreads, __ATOMIC_SEQ_CST);
+
+	for(size_t i = 0; i < cpucount; ++i){
+		if(__atomic_load_n(&arch_smp_getcls(i)->queuedthreads, __ATOMIC_SEQ_CST))
+			return true;
+	}
+
+	return false;
+}
+
+// kicks the first idle cpu the thread may run on so it picks up the thread
+
+static void wakeidle(thread_t* thread){
+	
+	cls_t* self = arch_getcls();
+	size_t cpucount = arch_smp_cpucount();
+
+	for(size_t i = 0; i < cpucount; ++i){
+		cls_t* cpu = arch_smp_getcls(i);
+		if(cpu == self || !cpuset_isset(&thread->affinity, i))
+			continue;
+		// clearing the flag claims the cpu so other wakers pick a different one
+		if(!__atomic_exchange_n(&cpu->idle, false, __ATOMIC_SEQ_CST))
+			continue;
+		arch_smp_wakeidle(cpu);
+		return;
+	}
+
+}
+
+static void quantum_arm(cls_t* cpu, bool start){
+	if(cpu->quantumarmed)
+		return;
+	cpu->quantumarmed = true;
+	timer_add(&cpu->schedreq, THREAD_QUANTUM, start);
+}
+
+static void quantum_disarm(cls_t* cpu){
+	if(!cpu->quantumarmed)
+		return;
+	cpu->quantumarmed = false;
+	timer_remove(&cpu->schedreq);
+}
+
+// gets the quantum interrupt to go off right away
+
+static void quantum_now(cls_t* cpu){
+	quantum_disarm(cpu);
+	cpu->quantumarmed = true;
+	timer_add(&cpu->schedreq, 0, true);
+}
+
+// a throttled cpu needs the quantum to see the end of the period
+
+static void quantum_update(cls_t* cpu, thread_t* next, bool start){
+	if(!nohz || cpu->rtthrottled || (next != cpu->idlethread && anyqueued()))
+		quantum_arm(cpu, start);
+	else
+		quantum_disarm(cpu);
+}
+
+// the min vruntime only moves forward and is what new, woken and migrated threads
+// are placed relative to
+
+static void updateminvruntime(sched_queue* queue, thread_t* current){
+	
+	uint64_t min = ~(uint64_t)0;
+	thread_t* first = queue_first(queue);
+
+	if(current)
+		min = current->vruntime;
+
+	if(first && first->vruntime < min)
+		min = first->vruntime;
+
+	if(min != ~(uint64_t)0 && min > queue->minvruntime)
+		queue->minvruntime = min;
+
+}
+
+static void histadd(size_t* hist, uint64_t ns){
+	uint64_t us = ns / 1000;
+	size_t bucket = us ? 64 - __builtin_clzl(us) : 0;
+	if(bucket >= SCHED_HISTSIZE)
+		bucket = SCHED_HISTSIZE - 1;
+	++hist[bucket];
+}
+
+static void countswitch(cls_t* cpu, thread_t* thread, bool voluntary){
+	
+	if(thread == cpu->idlethread)
+		return;
+
+	if(voluntary){
+		++thread->voluntary;
+		++cpu->voluntary;
+	}
+	else{
+		++thread->involuntary;
+		++cpu->involuntary;
+	}
+
+}
 
+// charges the time since the thread was picked
+
+static void account(cls_t* cpu, thread_t* thread){
+	
+	uint64_t time = now();
+	uint64_t delta = time - thread->runstart;
+	thread->runstart = time;
+
+	if(thread == cpu->idlethread)
+		return;
+
+	thread->runtime += delta;
+	histadd(cpu->runtimehist, delta);
+
+	if(thread->priority == THREAD_PRIORITY_REALTIME){
+		rt_charge(cpu, thread, time, delta);
+		return;
+	}
+
+	if(thread->priority != THREAD_PRIORITY_USER || thread == cpu->idlethread)
+		return;
+
+	thread->vruntime += delta * NICE_0_WEIGHT / niceweights[thread->nice - SCHED_NICE_MIN];
 	
+	sched_queue* queue = &cpu->queues[THREAD_PRIORITY_USER];
+
+	ticketlock_acquire(&queue->lock);
+	updateminvruntime(queue, thread);
+	ticketlock_release(&queue->lock);
+
+}
 
+// picks the local cpu if the affinity allows it, otherwise the last cpu the thread ran on
+// or the first one it is allowed on
+
+static cls_t* enqueuetarget(thread_t* thread){
+	
+	cls_t* self = arch_getcls();
+	size_t cpucount = arch_smp_cpucount();
+
+	if(cpucount == 0 || cpuset_isset(&thread->affinity, self->cpunum))
+		return self;
+
+	if(thread->lastcpu != -1 && cpuset_isset(&thread->affinity, thread->lastcpu))
+		return arch_smp_getcls(thread->lastcpu);
+
+	for(size_t i = 0; i < cpucount; ++i){
+		if(cpuset_isset(&thread->affinity, i))
+			return arch_smp_getcls(i);
+	}
+
+	return self;
+
+}
+
+// threads are queued on the local cpu when possible, idle cpus steal them from there.
+// expects interrupts to be disabled
+
+static void enqueue(thread_t* thread, bool wake){
+	
+	cls_t* cpu = enqueuetarget(thread);
+	sched_queue* queue = &cpu->queues[thread->priority];
+	
+	ticketlock_acquire(&queue->lock);
+	
+	// new threads start at the back of the line
+	if(queue->fair && thread->lastcpu == -1 && thread->vruntime < queue->minvruntime)
+		thread->vruntime = queue->minvruntime;
+
+	thread->waitstart = now();
+	thread->queuedcpu = cpu->cpunum;
+	thread->queuedpriority = thread->priority;
+	queue_add(queue, thread);
+	__atomic_add_fetch(&cpu->queuedthreads, 1, __ATOMIC_SEQ_CST);
+	ticketlock_release(&queue->lock);
+
+	// the other cpu arms its own quantum or leaves idle when it gets the ipi
+
+	if(cpu != arch_getcls()){
+		arch_smp_resched(cpu);
+		return;
+	}
+
+	if(wake){
+		// the running thread has competition now
+		if(rt_waiting(cpu))
+			quantum_now(cpu);
+		else if(cpu->thread != cpu->idlethread)
+			quantum_arm(cpu, true);
+		wakeidle(thread);
+	}
+
+}
+
+// first thread in the queue that may run on the cpu
+
+static thread_t* queue_firstallowed(sched_queue* queue, size_t cpunum){
+	
+	thread_t* thread = queue_first(queue);
+
+	while(thread && !cpuset_isset(&thread->affinity, cpunum))
+		thread = queue_next(queue, thread);
+
+	return thread;
+}
+
+static thread_t* dequeuefrom(cls_t* cpu, cls_t* forcpu){
+	
 	thread_t* thread = NULL;
 
-	while(thread == NULL){
+	for(int i = 0; i < QUEUE_COUNT && thread == NULL; ++i){
+		
+		sched_queue* queue = &cpu->queues[i];
 
-		for(int i = 0; i < QUEUE_COUNT && thread == NULL; ++i){
-			
-			spinlock_acquire(&queues[i].lock);
-			
-			if(queues[i].start){
-				thread = queues[i].start;
-				queue_remove(&queues[i], thread);
-			}
+		if(!queue_hasthreads(queue) || (i == THREAD_PRIORITY_REALTIME && forcpu->rtthrottled))
+			continue;
 
-			spinlock_release(&queues[i].lock);
+		ticketlock_acquire(&queue->lock);
+		
+		thread = queue_firstallowed(queue, forcpu->cpunum);
 
+		if(thread){
+			queue_remove(queue, thread);
+			thread->queuedcpu = -1;
+			__atomic_sub_fetch(&cpu->queuedthreads, 1, __ATOMIC_SEQ_CST);
 		}
 
-		if(!thread){
-			arch_interrupt_enable();
-			arch_halt();
-			arch_interrupt_disable();
+		ticketlock_release(&queue->lock);
 
-		}
+	}
 
+	return thread;
+
+}
+
+// vruntime only means something relative to the queue it was in, so the lag
+// behind the old cpu's minimum is kept on the new one
+
+static void movevruntime(thread_t* thread, cls_t* from, cls_t* to){
+	
+	if(thread->priority != THREAD_PRIORITY_USER || from == to)
+		return;
+
+	uint64_t oldmin = from->queues[THREAD_PRIORITY_USER].minvruntime;
+	uint64_t lag = thread->vruntime > oldmin ? thread->vruntime - oldmin : 0;
+	thread->vruntime = to->queues[THREAD_PRIORITY_USER].minvruntime + lag;
+
+}
+
+// pulls a thread from the sibling with the most queued threads.
+// if nothing there may run here the rest are tried in order
+
+static thread_t* steal(cls_t* self){
+	
+	cls_t* busiest = NULL;
+	size_t busiestcount = 0;
+	size_t cpucount = arch_smp_cpucount();
+
+	for(size_t i = 0; i < cpucount; ++i){
+		cls_t* cpu = arch_smp_getcls(i);
+		size_t count = __atomic_load_n(&cpu->queuedthreads, __ATOMIC_SEQ_CST);
+		if(cpu == self || count <= busiestcount)
+			continue;
+		busiest = cpu;
+		busiestcount = count;
+	}
+
+	if(!busiest)
+		return NULL;
+
+	thread_t* thread = dequeuefrom(busiest, self);
+
+	for(size_t i = 0; i < cpucount && !thread; ++i){
+		cls_t* cpu = arch_smp_getcls(i);
+		if(cpu == self || cpu == busiest || !__atomic_load_n(&cpu->queuedthreads, __ATOMIC_SEQ_CST))
+			continue;
+		busiest = cpu;
+		thread = dequeuefrom(cpu, self);
 	}
+
+	if(!thread)
+		return NULL;
+
+	++self->steals;
+
+	movevruntime(thread, busiest, self);
+
+	return thread;
+
+}
+
+// if nothing is runnable the cpu's idle thread is returned
+
+static thread_t* getnext(){
+	
+	cls_t* cpu = arch_getcls();
+
+	rt_refresh(cpu, now());
+
+	thread_t* thread = dequeuefrom(cpu, cpu);
+
+	if(!thread)
+		thread = steal(cpu);
+
+	if(!thread)
+		return cpu->idlethread;
+	
+	__atomic_store_n(&cpu->idle, false, __ATOMIC_SEQ_CST);
+
+	if(thread->lastcpu != -1 && thread->lastcpu != (int)cpu->cpunum)
+		++cpu->migrations;
+
+	thread->lastcpu = cpu->cpunum;
+	thread->oncpu = true;
+	thread->runstart = now();
+
+	uint64_t latency = thread->runstart - thread->waitstart;
+	thread->waittime += latency;
+	if(latency > thread->maxlatency)
+		thread->maxlatency = latency;
+	histadd(cpu->latencyhist, latency);
 	
 	return thread;
 
 }
 
 void sched_queuethread(thread_t* thread){
+	arch_interrupt_disable();
+	enqueue(thread, true);
+	arch_interrupt_enable();
+}
+
+// the idle flag is set before the queues are checked and enqueue() clears it after
+// adding, so either this cpu sees the new thread or the other cpu wakes it up.
+// getnext() clears the flag when it picks something, so if it survives the yield
+// nothing here could be run (e.g. only threads pinned elsewhere are queued).
+// the wait itself is mwait on the flag if the cpu has it, hlt otherwise
+
+__attribute__((noreturn)) void sched_idle(){
+	
+	cls_t* cpu = arch_getcls();
+
+	for(;;){
+		arch_interrupt_disable();
+		__atomic_store_n(&cpu->idle, true, __ATOMIC_SEQ_CST);
+		
+		if(anyqueued())
+			sched_yield();
+
+		if(!__atomic_load_n(&cpu->idle, __ATOMIC_SEQ_CST))
+			continue;
+
+		uint64_t start = now();
+		++cpu->idleentries;
+
+		arch_cpu_idlewait(&cpu->idle);
+
+		arch_interrupt_disable();
+		cpu->idletime += now() - start;
+		arch_interrupt_enable();
+	}
+
+}
+
+// called from the reschedule ipi, a thread was queued here by another cpu
+
+void sched_resched(){
+	
+	cls_t* cpu = arch_getcls();
+
+	if(rt_waiting(cpu))
+		quantum_now(cpu);
+	else if(cpu->thread != cpu->idlethread)
+		quantum_arm(cpu, true);
+
+}
+
+// tid 0 is the calling thread, otherwise only threads of the calling process can be found
+
+thread_t* sched_findthread(pid_t tid){
 	
-	sched_queue* queue = &queues[thread->priority];
+	thread_t* thread = arch_getcls()->thread;
+	proc_t* proc = thread->proc;
+
+	if(tid == 0 || tid == thread->tid)
+		return thread;
+	
+	thread_t* target = NULL;
+
+	spinlock_acquire(&proc->lock);
+
+	for(size_t i = 0; i < proc->threadcount; ++i){
+		if(proc->threads[i]->tid == tid && proc->threads[i]->state != THREAD_STATE_DEAD){
+			target = proc->threads[i];
+			break;
+		}
+	}
+	
+	spinlock_release(&proc->lock);
+
+	return target;
+
+}
+
+// a queued thread that can't run where it is queued anymore is moved right away,
+// a running one moves at its next enqueue and the caller yields if it excluded its own cpu
+
+int sched_setaffinity(thread_t* thread, cpuset_t* set){
+	
+	size_t cpucount = arch_smp_cpucount();
+	cpuset_t newset;
+	bool any = false;
+
+	cpuset_clear(&newset);
+
+	for(size_t i = 0; i < (cpucount ? cpucount : 1); ++i){
+		if(!cpuset_isset(set, i))
+			continue;
+		cpuset_set(&newset, i);
+		any = true;
+	}
+
+	if(!any)
+		return EINVAL;
 	
 	arch_interrupt_disable();
-	spinlock_acquire(&queue->lock);
+	spinlock_acquire(&thread->lock);
 	
-	queue_add(queue, thread);
+	thread->affinity = newset;
+
+	// the cpu it is queued on might never look at it again and the ones it
+	// can go to don't know about it. it can leave the queue until the lock is taken
+
+	int queuedcpu = __atomic_load_n(&thread->queuedcpu, __ATOMIC_SEQ_CST);
+
+	if(queuedcpu != -1 && !cpuset_isset(&newset, queuedcpu)){
+		cls_t* cpu = arch_smp_getcls(queuedcpu);
+		sched_queue* queue = &cpu->queues[thread->queuedpriority];
+		bool moved = false;
+
+		ticketlock_acquire(&queue->lock);
+
+		if(thread->queuedcpu == queuedcpu){
+			queue_remove(queue, thread);
+			thread->queuedcpu = -1;
+			__atomic_sub_fetch(&cpu->queuedthreads, 1, __ATOMIC_SEQ_CST);
+			moved = true;
+		}
+
+		ticketlock_release(&queue->lock);
+
+		if(moved){
+			movevruntime(thread, cpu, enqueuetarget(thread));
+			enqueue(thread, true);
+		}
+	}
+
+	spinlock_release(&thread->lock);
+	arch_interrupt_enable();
+
+	return 0;
+
+}
+
+// like the affinity, the thread changes queues at its next enqueue.
+// the caller yields if it changed itself
+
+int sched_setscheduler(thread_t* thread, int policy, int rtpriority){
 	
-	spinlock_release(&queue->lock);
+	switch(policy){
+		case SCHED_OTHER:
+			if(rtpriority != 0)
+				return EINVAL;
+			break;
+		case SCHED_FIFO:
+		case SCHED_RR:
+			if(rtpriority < SCHED_RTPRIO_MIN || rtpriority > SCHED_RTPRIO_MAX)
+				return EINVAL;
+			break;
+		default:
+			return EINVAL;
+	}
+
+	arch_interrupt_disable();
+	spinlock_acquire(&thread->lock);
+
+	// vruntime only means something relative to the queue it goes back to
+
+	if(policy == SCHED_OTHER && thread->policy != SCHED_OTHER)
+		thread->vruntime = arch_getcls()->queues[THREAD_PRIORITY_USER].minvruntime;
+
+	thread->policy = policy;
+	thread->rtpriority = rtpriority;
+	thread->rrslice = RR_TIMESLICE;
+	thread->priority = policy == SCHED_OTHER ? THREAD_PRIORITY_USER : THREAD_PRIORITY_REALTIME;
+
+	spinlock_release(&thread->lock);
 	arch_interrupt_enable();
+
+	return 0;
+
+}
+
+// new threads and forked processes keep the policy of their creator
+
+void sched_copypolicy(thread_t* thread, thread_t* from){
+	thread->policy = from->policy;
+	thread->rtpriority = from->rtpriority;
+	thread->rrslice = RR_TIMESLICE;
+	thread->priority = from->priority;
+}
+
+// a running real time thread isn't preempted by the quantum, only by the
+// queues above it, a higher priority, the end of its rr slice or throttling
+
+static bool rt_keepcpu(cls_t* cpu, thread_t* thread){
+	
+	if(thread->priority != THREAD_PRIORITY_REALTIME || thread->state != THREAD_STATE_RUNNING)
+		return false;
+
+	account(cpu, thread);
+
+	if(cpu->rtthrottled)
+		return false;
+
+	for(int i = 0; i < THREAD_PRIORITY_REALTIME; ++i){
+		if(queue_hasthreads(&cpu->queues[i])){
+			thread->rtfront = true;
+			return false;
+		}
+	}
+
+	int prio = rt_highest(cpu->queues[THREAD_PRIORITY_REALTIME].rt, SCHED_RTPRIO_MAX + 1);
+
+	if(prio > thread->rtpriority){
+		thread->rtfront = true;
+		return false;
+	}
+
+	if(thread->policy == SCHED_RR && thread->rrslice == 0){
+		thread->rrslice = RR_TIMESLICE;
+		return prio < thread->rtpriority;
+	}
+
+	return true;
+
 }
 
 void sched_timerhook(arch_regs* regs){
@@ -196,51 +931,76 @@ void sched_timerhook(arch_regs* regs){
 
 	#endif
 
-	thread_t* current = arch_getcls()->thread;
+	cls_t* cpu = arch_getcls();
+	thread_t* current = cpu->thread;
+	
+	cpu->quantumarmed = false;
+	
+	// nothing else wants the cpu, keep going without a quantum
+	
+	if(nohz && current != cpu->idlethread && !anyqueued())
+		return;
+
+	if(rt_keepcpu(cpu, current)){
+		quantum_update(cpu, current, false);
+		return;
+	}
+
+	// it holds a spinlock, the switch happens once it lets go of it.
+	// the quantum is armed again in case it lets go with interrupts off
+
+	if(cpu->preemptcount){
+		cpu->needresched = true;
+		quantum_arm(cpu, false);
+		return;
+	}
+
+	cpu->needresched = false;
 
-	sched_queue* currentqueue = &queues[current->priority];
+	// the registers have to be saved before the thread is visible to other cpus
 		
 	memcpy(current->regs, regs, sizeof(arch_regs));
 	arch_regs_saveextra(&current->extraregs);
+	account(cpu, current);
 
-	spinlock_acquire(&currentqueue->lock);
-
-	queue_add(currentqueue, current);
+	spinlock_acquire(&current->lock);
+	
+	current->oncpu = false;
+	if(current != cpu->idlethread && current->state == THREAD_STATE_RUNNING)
+		enqueue(current, false);
 
-	spinlock_release(&currentqueue->lock);
+	spinlock_release(&current->lock);
 
 	thread_t* next = getnext();
 
-	arch_getcls()->thread = next;
-	
+	// only a preemption if something else got the cpu
+	if(next != current)
+		countswitch(cpu, current, false);
 
-	if(next){
-		memcpy(regs, next->regs, sizeof(arch_regs));
-	}
+	cpu->thread = next;
+	cpu->preemptcount = next->preemptcount;
+	
+	memcpy(regs, next->regs, sizeof(arch_regs));
 	
-	if(next->ctx != current->ctx)
+	if(next->ctx != cpu->context)
 		vmm_switchcontext(next->ctx);	
 
 
 	arch_setkernelstack(next->kernelstack);
 	arch_regs_setupextra(&next->extraregs);
 
-	timer_add(&arch_getcls()->schedreq, THREAD_QUANTUM, false);
-
-
-
+	quantum_update(cpu, next, false);
 
 }
 
 void switch_thread(thread_t* thread){
 	
-	thread_t* current = arch_getcls()->thread;
-	
 	// if we don't have to change address spaces don't waste time
 	
 	arch_getcls()->thread = thread;
+	arch_getcls()->preemptcount = thread->preemptcount;
 
-	if(thread->ctx != current->ctx)
+	if(thread->ctx != arch_getcls()->context)
 		vmm_switchcontext(thread->ctx);
 
 	arch_setkernelstack(thread->kernelstack);
@@ -260,7 +1020,7 @@ thread_t* sched_newuthread(void* ip, size_t kstacksize, void* stack, proc_t* pro
 	if(!proc){
 		proc = allocproc(1);
 		if(!proc){
-			freethread(thread);
+			sched_freethread(thread);
 			return NULL;
 		}
 		thread->tid = proc->pid;
@@ -271,7 +1031,7 @@ thread_t* sched_newuthread(void* ip, size_t kstacksize, void* stack, proc_t* pro
 		spinlock_acquire(&proc->lock);
 		thread_t** tmp = realloc(proc->threads, sizeof(thread_t*) * (proc->threadcount + 1));
 		if(!tmp){
-			freethread(thread);
+			sched_freethread(thread);
 			return NULL;
 		}
 		proc->threads = tmp;
@@ -286,13 +1046,8 @@ thread_t* sched_newuthread(void* ip, size_t kstacksize, void* stack, proc_t* pro
 	thread->proc = proc;
 	arch_regs_setupuser(thread->regs, ip, stack, true);
 
-	if(run){
-		arch_interrupt_disable();
-		spinlock_acquire(&queues[prio].lock);
-		queue_add(&queues[prio], thread);
-		spinlock_release(&queues[prio].lock);
-		arch_interrupt_enable();
-	}
+	if(run)
+		sched_queuethread(thread);
 
 	return thread;
 
@@ -307,28 +1062,48 @@ thread_t* sched_newkthread(void* ip, size_t stacksize, bool run, int prio){
 
 	arch_regs_setupkernel(thread->regs, ip, thread->kernelstack, true);
 
-	if(run){
-		arch_interrupt_disable();
-		spinlock_acquire(&queues[prio].lock);
-		queue_add(&queues[prio], thread);
-		spinlock_release(&queues[prio].lock);
-		arch_interrupt_enable();
-	}
+	if(run)
+		sched_queuethread(thread);
 	return thread;
 }
 
+// runs on the cpu's scheduler stack, as once the thread is queued
+// another cpu may start running it on its own kernel stack
+
 void sched_yieldtrampoline(thread_t* thread){
 	
 	arch_regs_saveextra(&thread->extraregs);
-		
-	if(thread->state == THREAD_STATE_RUNNING){
-		spinlock_acquire(&queues[thread->priority].lock);
-		queue_add(&queues[thread->priority], thread);
-		spinlock_release(&queues[thread->priority].lock);
-	}
+	account(arch_getcls(), thread);
+	countswitch(arch_getcls(), thread, true);
+	
+	spinlock_acquire(&thread->lock);
+	
+	state_t state = thread->state;
+
+	// a dead thread is left on the cpu until its address space isn't loaded anymore
 
+	if(state != THREAD_STATE_DEAD)
+		thread->oncpu = false;
+
+	if(state == THREAD_STATE_RUNNING && thread != arch_getcls()->idlethread)
+		enqueue(thread, false);
+	
+	spinlock_release(&thread->lock);
 
 	thread_t* nthread = getnext();
+	
+	// waitpid frees the dead thread's stack and address space once it is off
+	// the cpu, so nothing of it or its process can be touched after that
+
+	if(state == THREAD_STATE_DEAD){
+		arch_getcls()->thread = nthread;
+		if(nthread->ctx != arch_getcls()->context)
+			vmm_switchcontext(nthread->ctx);
+		spinlock_release(&thread->proc->threadexitlock);
+		__atomic_store_n(&thread->oncpu, false, __ATOMIC_RELEASE);
+	}
+	
+	quantum_update(arch_getcls(), nthread, false);
 
 	timer_resume();
 	
@@ -336,7 +1111,7 @@ void sched_yieldtrampoline(thread_t* thread){
 
 }
 
-void arch_sched_yieldtrampoline(thread_t* thread, arch_regs* regs);
+void arch_sched_yieldtrampoline(thread_t* thread, arch_regs* regs, void* stack);
 
 // these 3 expect interrupts to be disabled in entry
 
@@ -344,50 +1119,83 @@ void sched_yield(){
 	
 	timer_stop();
 
-	thread_t* thread = arch_getcls()->thread;
+	cls_t* cpu = arch_getcls();
+	thread_t* thread = cpu->thread;
+
+	// it may be going to sleep with a lock held, the count goes with it
 
-	arch_sched_yieldtrampoline(thread, thread->regs);
+	thread->preemptcount = cpu->preemptcount;
+	cpu->needresched = false;
+
+	arch_sched_yieldtrampoline(thread, thread->regs, cpu->schedulerstack);
 
 }
 
-void sched_eventsignal(event_t* event, thread_t* thread){
+// called once a thread drops its last spinlock after the timer wanted to
+// switch it out. with interrupts off it is left to the next tick, and a thread
+// that is about to block will leave the cpu on its own
 
-	if(thread->state != THREAD_STATE_BLOCKED && thread->state != THREAD_STATE_BLOCKED_INTR)
+void sched_preempt(){
+	
+	if(!arch_interrupt_save())
 		return;
 
-	if(thread->state == THREAD_STATE_BLOCKED_INTR && event == &thread->sigevent)
+	if(arch_getcls()->thread->state != THREAD_STATE_RUNNING){
+		arch_interrupt_enable();
 		return;
+	}
+
+	sched_yield();
+
+	arch_interrupt_enable();
+
+}
+
+// returns false if the thread wasn't waiting to be woken up by the event
+
+bool sched_eventsignal(event_t* event, thread_t* thread){
+
+	spinlock_acquire(&thread->lock);
+
+	if(thread->state != THREAD_STATE_BLOCKED && thread->state != THREAD_STATE_BLOCKED_INTR){
+		spinlock_release(&thread->lock);
+		return false;
+	}
+
+	if(thread->state == THREAD_STATE_BLOCKED_INTR && event == &thread->sigevent){
+		spinlock_release(&thread->lock);
+		return false;
+	}
 	
 	thread->state = THREAD_STATE_RUNNING;
 	thread->awokenby = event;
-	
-	spinlock_acquire(&queues[thread->priority].lock);
-	queue_add(&queues[thread->priority], thread);
-	spinlock_release(&queues[thread->priority].lock);
-}
 
-void sched_dequeue(long state){
+	// sleepers get a bounded head start over the threads that kept running
+	// on the cpu it gets queued on
 
-	timer_stop();
-	arch_interrupt_disable();	
-
-	thread_t* current = arch_getcls()->thread;
-	thread_t* thread = getnext();
+	if(thread->priority == THREAD_PRIORITY_USER){
+		uint64_t min = enqueuetarget(thread)->queues[THREAD_PRIORITY_USER].minvruntime;
+		if(min > SLEEPER_CREDIT && thread->vruntime < min - SLEEPER_CREDIT)
+			thread->vruntime = min - SLEEPER_CREDIT;
+	}
 	
-	timer_resume();
+	// if it is still on its way out of a cpu the yield path will queue it
 
-	// for safety
+	if(!thread->oncpu)
+		enqueue(thread, true);
 
+	spinlock_release(&thread->lock);
 
-	arch_getcls()->thread = thread;
-	vmm_switchcontext(thread->ctx);
+	return true;
+}
 
-	current->state = state;
-	if(state == THREAD_STATE_DEAD)
-		spinlock_release(&current->proc->threadexitlock);
+void sched_dequeue(long state){
 
-	switch_thread(thread);
+	arch_interrupt_disable();	
+	
+	arch_getcls()->thread->state = state;
 	
+	sched_yield();
 
 }
 
@@ -401,25 +1209,95 @@ void sched_threadexitcheck(){
 }
 
 
-void sched_block(bool interruptible){
+void sched_prepareblock(bool interruptible){
 	
 	thread_t* thread = arch_getcls()->thread;
 	
+	spinlock_acquire(&thread->lock);
 	thread->state = interruptible ? THREAD_STATE_BLOCKED_INTR : THREAD_STATE_BLOCKED;
+	spinlock_release(&thread->lock);
+
+}
+
+// for when the thread finds out it doesn't have to sleep after all
+
+void sched_cancelblock(){
+	
+	thread_t* thread = arch_getcls()->thread;
+	
+	spinlock_acquire(&thread->lock);
+	thread->state = THREAD_STATE_RUNNING;
+	spinlock_release(&thread->lock);
+
+}
+
+void sched_block(bool interruptible){
+	
+	sched_prepareblock(interruptible);
 	
 	sched_yield();
 
 }
 
+// sets up the calling context as this cpu's boot thread
+
+static void cpuinit(){
+	
+	cls_t* cpu = arch_getcls();
+
+	cpu->thread = allocthread(NULL, THREAD_STATE_RUNNING, 0, 0);
+	
+	if(!cpu->thread)
+		_panic("Out of memory", 0);
+
+	cpu->thread->priority = THREAD_PRIORITY_KERNEL;
+	cpu->thread->oncpu = true;
+
+	cpu->schedulerstack = alloc(SCHEDULER_STACK_SIZE);
+
+	if(!cpu->schedulerstack)
+		_panic("Out of memory", 0);
+
+	cpu->schedulerstack += SCHEDULER_STACK_SIZE;
+
+	rbtree_init(&cpu->queues[THREAD_PRIORITY_USER].tree, vruntimecmp);
+	cpu->queues[THREAD_PRIORITY_USER].fair = true;
+
+	cpu->queues[THREAD_PRIORITY_REALTIME].rt = alloc(sizeof(sched_rtlists));
+
+	if(!cpu->queues[THREAD_PRIORITY_REALTIME].rt)
+		_panic("Out of memory", 0);
+
+	cpu->schedreq.func = sched_timerhook;
+
+	quantum_arm(cpu, true);
+
+}
+
 void sched_init(){
-	arch_getcls()->thread = allocthread(NULL, THREAD_STATE_RUNNING, 0, 0);
-	arch_getcls()->thread->priority = THREAD_PRIORITY_KERNEL;
+	
+	slab_cacheinit(&threadcache, sizeof(thread_t), threadctor);
+	slab_cacheinit(&proccache, sizeof(proc_t), NULL);
+	slab_cacheinit(&regscache, sizeof(arch_regs), NULL);
+
+	nohz = !env_isset("periodictick");
+
+	cpuinit();
+
+	arch_getcls()->idlethread = sched_newkthread(sched_idle, PAGE_SIZE*4, false, THREAD_PRIORITY_KERNEL);
+
+	if(!arch_getcls()->idlethread)
+		_panic("Out of memory", 0);
+
+}
+
+// the ap boot context is reused as the idle thread
 
-	timer_req* req = &arch_getcls()->schedreq;
+void sched_apinit(){
 	
-	req->func = sched_timerhook;
+	cpuinit();
 
-	timer_add(&arch_getcls()->schedreq, THREAD_QUANTUM, true);
+	arch_getcls()->idlethread = arch_getcls()->thread;
 
 }
 
@@ -433,6 +1311,8 @@ void sched_runinit(){
 	init = proc;
 
 	arch_getcls()->thread = thread;
+	thread->oncpu = true;
+	thread->runstart = now();
 
 	vmm_switchcontext(thread->ctx);
 
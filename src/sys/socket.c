@@ -105,10 +105,10 @@ int socket_recv(socket_t* socket, void* buff, size_t len, int flags, int* error,
 	}
 }
 
-int socket_poll(socket_t* socket, pollfd* fd){
+int socket_poll(socket_t* socket, pollfd* fd, poll_table* table){
 	switch(socket->family){
 		case AF_UNIX:
-			return unsocket_poll(socket, fd);
+			return unsocket_poll(socket, fd, table);
 		default:
 			return EINVAL;
 	}
@@ -6,6 +6,7 @@
 #include <kernel/ustring.h>
 
 #define CLOCK_REALTIME 0
+#define CLOCK_MONOTONIC 1
 
 syscallret syscall_clock_gettime(int clockid, struct timespec *tp){
 	
@@ -23,6 +24,10 @@ syscallret syscall_clock_gettime(int clockid, struct timespec *tp){
 			struct timespec t = arch_timekeeper_gettime();
 			retv.errno = u_memcpy(tp, &t, sizeof(struct timespec));
 			break;
+		case CLOCK_MONOTONIC:
+			struct timespec m = arch_timekeeper_gettimefromboot();
+			retv.errno = u_memcpy(tp, &m, sizeof(struct timespec));
+			break;
 		default:
 			retv.errno = EINVAL;
 
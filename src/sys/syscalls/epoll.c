@@ -0,0 +1,209 @@
+#include <kernel/syscalls.h>
+#include <kernel/epoll.h>
+#include <kernel/fd.h>
+#include <kernel/alloc.h>
+#include <kernel/ustring.h>
+#include <kernel/vmm.h>
+#include <arch/cls.h>
+#include <errno.h>
+
+#define MAXEVENTS 4096
+
+extern fs_t kerneltmpfs;
+
+syscallret syscall_epoll_create1(int flags){
+
+	syscallret retv;
+	retv.ret = -1;
+
+	// close on exec isn't implemented for any fd yet
+
+	if(flags & ~EPOLL_CLOEXEC){
+		retv.errno = EINVAL;
+		return retv;
+	}
+
+	proc_t* proc = arch_getcls()->thread->proc;
+
+	fd_t* fd = NULL;
+	int   ifd;
+
+	retv.errno = fd_alloc(&proc->fdtable, &fd, &ifd, 0);
+
+	if(retv.errno)
+		return retv;
+
+	fd->node = vfs_newnode("EPOLL", &kerneltmpfs, NULL);
+	if(!fd->node){
+		retv.errno = ENOMEM;
+		goto _fail;
+	}
+	fd->mode = 0600 | MAKETYPE(TYPE_EPOLL);
+	fd->flags = O_RDWR+1;
+	fd->node->refcount = 1;
+	fd->node->st.st_mode = fd->mode;
+
+	epoll_t* epoll = epoll_create();
+
+	if(!epoll){
+		retv.errno = ENOMEM;
+		goto _fail;
+	}
+
+	fd->node->objdata = epoll;
+
+	fd_release(fd);
+
+	retv.errno = 0;
+	retv.ret = ifd;
+	return retv;
+
+	_fail:
+
+	if(fd){
+		fd_release(fd);
+		fd_free(&proc->fdtable, ifd);
+	}
+
+	return retv;
+
+}
+
+// returns the epoll fd's vnode with a reference held, so the fd lock
+// doesn't have to be kept while sleeping
+
+static int getepoll(fdtable_t* fdtable, int ifd, vnode_t** node){
+
+	fd_t* fd;
+
+	int err = fd_access(fdtable, &fd, ifd);
+
+	if(err)
+		return err;
+
+	if(GETTYPE(fd->node->st.st_mode) != TYPE_EPOLL){
+		fd_release(fd);
+		return EINVAL;
+	}
+
+	*node = fd->node;
+	vfs_acquirenode(*node);
+
+	fd_release(fd);
+
+	return 0;
+
+}
+
+syscallret syscall_epoll_ctl(int epfd, int op, int ifd, epoll_event* uevent){
+
+	syscallret retv;
+	retv.ret = -1;
+
+	if(uevent > USER_SPACE_END){
+		retv.errno = EFAULT;
+		return retv;
+	}
+
+	if(epfd == ifd){
+		retv.errno = EINVAL;
+		return retv;
+	}
+
+	epoll_event event = {0};
+
+	if(op != EPOLL_CTL_DEL){
+		retv.errno = u_memcpy(&event, uevent, sizeof(epoll_event));
+		if(retv.errno)
+			return retv;
+	}
+
+	fdtable_t* fdtable = &arch_getcls()->thread->proc->fdtable;
+
+	vnode_t* epnode;
+
+	retv.errno = getepoll(fdtable, epfd, &epnode);
+
+	if(retv.errno)
+		return retv;
+
+	fd_t* fd;
+
+	retv.errno = fd_access(fdtable, &fd, ifd);
+
+	if(retv.errno){
+		vfs_close(epnode);
+		return retv;
+	}
+
+	// epoll_wait looks up fds with the instance locked, so the fd isn't kept
+	// locked while the instance is taken here
+
+	vnode_t* node = fd->node;
+	vfs_acquirenode(node);
+	fd_release(fd);
+
+	retv.errno = epoll_ctl(epnode->objdata, op, ifd, node, &event);
+
+	vfs_close(node);
+	vfs_close(epnode);
+
+	if(retv.errno == 0)
+		retv.ret = 0;
+
+	return retv;
+
+}
+
+syscallret syscall_epoll_wait(int epfd, epoll_event* uevents, int maxevents, int timeoutms){
+
+	syscallret retv;
+	retv.ret = -1;
+
+	if(uevents > USER_SPACE_END){
+		retv.errno = EFAULT;
+		return retv;
+	}
+
+	if(maxevents <= 0){
+		retv.errno = EINVAL;
+		return retv;
+	}
+
+	// returning fewer events than asked for is fine
+
+	if(maxevents > MAXEVENTS)
+		maxevents = MAXEVENTS;
+
+	vnode_t* epnode;
+
+	retv.errno = getepoll(&arch_getcls()->thread->proc->fdtable, epfd, &epnode);
+
+	if(retv.errno)
+		return retv;
+
+	epoll_event* events = alloc(maxevents * sizeof(epoll_event));
+
+	if(!events){
+		vfs_close(epnode);
+		retv.errno = ENOMEM;
+		return retv;
+	}
+
+	int count;
+
+	retv.errno = epoll_wait(epnode->objdata, events, maxevents, timeoutms, &count);
+
+	vfs_close(epnode);
+
+	if(retv.errno == 0)
+		retv.errno = u_memcpy(uevents, events, count * sizeof(epoll_event));
+
+	if(retv.errno == 0)
+		retv.ret = count;
+
+	free(events);
+
+	return retv;
+
+}
@@ -5,6 +5,7 @@
 #include <kernel/sched.h>
 #include <arch/cls.h>
 #include <arch/regs.h>
+#include <arch/vdso.h>
 
 syscallret syscall_fork(arch_regs* ctx){
 	
@@ -29,15 +30,15 @@ syscallret syscall_fork(arch_regs* ctx){
 
 	if(err){
 		vmm_destroy(newthread->ctx);
-		free(newthread->regs);
-		free(newthread->kernelstackbase);
-		free(newthread);
+		sched_freethread(newthread);
 		retv.errno = err;
 		return retv;
 	}
 	
 	newthread->tid = newproc->pid;
 
+	arch_vdso_fork(newthread->ctx, newproc);
+
 	newproc->parent = proc;
 	newproc->sibling = proc->child;
        	proc->child = newproc;	
@@ -52,7 +53,11 @@ syscallret syscall_fork(arch_regs* ctx){
 	newproc->cwd  = proc->cwd;
 
 	memcpy(newthread->regs, ctx, sizeof(arch_regs));
-	arch_regs_saveextra(&newthread->extraregs);
+	arch_regs_copyextra(&newthread->extraregs, &thread->extraregs);
+
+	newthread->nice = thread->nice;
+	sched_copypolicy(newthread, thread);
+	newthread->affinity = thread->affinity;
 
 	arch_regs_setret(newthread->regs, 0);
 	arch_regs_seterrno(newthread->regs, 0);
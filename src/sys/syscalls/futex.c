@@ -1,161 +1,351 @@
 #include <kernel/syscalls.h>
 #include <kernel/vmm.h>
+#include <kernel/pmm.h>
 #include <errno.h>
 #include <kernel/event.h>
+#include <kernel/timer.h>
+#include <kernel/ustring.h>
 #include <arch/spinlock.h>
 #include <arch/interrupt.h>
-#include <kernel/alloc.h>
-#include <arch/timekeeper.h>
 #include <arch/cls.h>
 #include <time.h>
 
 #define FUTEX_WAIT 0
 #define FUTEX_WAKE 1
+#define FUTEX_REQUEUE 3
+#define FUTEX_CMP_REQUEUE 4
 
-static int lock;
-typedef struct _futex{
-	struct _futex* next;
-	void* phyaddr;
-	size_t waitercount;
-	size_t waitersleft;
+// futexes are keyed on the physical address so this flag changes nothing
+#define FUTEX_PRIVATE_FLAG 128
+
+#define FUTEX_HASH_SIZE 256
+
+// longer timeouts are cut down to this, so the deadline can't wrap
+#define FUTEX_MAXTIMEOUTSEC (1ul << 32)
+
+// waiters live on the waiting thread's stack. key and the list links are only
+// changed with the lock of the bucket the waiter is in
+
+typedef struct _futex_waiter{
+	struct _futex_waiter* next;
+	struct _futex_waiter* prev;
+	void* key;
+	bool queued;
+	bool timedout;
 	event_t event;
-} futex_t;
+} futex_waiter;
 
-static futex_t* first;
+typedef struct{
+	int lock;
+	futex_waiter* first;
+	futex_waiter* last;
+} futex_bucket;
 
-static inline futex_t* getfutex(void *addr){
-	futex_t* iter = first;
+static futex_bucket buckets[FUTEX_HASH_SIZE];
 
-	while(iter){
-		if(iter->phyaddr == addr)
-			break;
-		iter = iter->next;
+static futex_bucket* getbucket(void* key){
+	uint64_t hash = ((uint64_t)key >> 2) * 0x9E3779B97F4A7C15ul;
+	return &buckets[hash >> 56];
+}
+
+static void addwaiter(futex_bucket* bucket, futex_waiter* waiter){
+	waiter->next = NULL;
+	waiter->prev = bucket->last;
+	waiter->queued = true;
+
+	if(bucket->last)
+		bucket->last->next = waiter;
+	else
+		bucket->first = waiter;
+
+	bucket->last = waiter;
+}
+
+static void removewaiter(futex_bucket* bucket, futex_waiter* waiter){
+	if(waiter->prev)
+		waiter->prev->next = waiter->next;
+	else
+		bucket->first = waiter->next;
+
+	if(waiter->next)
+		waiter->next->prev = waiter->prev;
+	else
+		bucket->last = waiter->prev;
+
+	waiter->queued = false;
+}
+
+// a requeue can move the waiter while the bucket is being locked
+
+static futex_bucket* lockwaiterbucket(futex_waiter* waiter){
+	for(;;){
+		void* key = __atomic_load_n(&waiter->key, __ATOMIC_SEQ_CST);
+		futex_bucket* bucket = getbucket(key);
+		spinlock_acquire(&bucket->lock);
+		if(waiter->key == key)
+			return bucket;
+		spinlock_release(&bucket->lock);
 	}
+}
+
+// the buckets are always taken in address order
 
-	return iter;
+static void lockpair(futex_bucket* a, futex_bucket* b){
+	if(a == b){
+		spinlock_acquire(&a->lock);
+		return;
+	}
+
+	if(a > b){
+		futex_bucket* tmp = a;
+		a = b;
+		b = tmp;
+	}
 
+	spinlock_acquire(&a->lock);
+	spinlock_acquire(&b->lock);
 }
 
-static inline void setfutex(futex_t* futex, void* paddr){
-	futex->next = first;
-	first = futex;
-	futex->phyaddr = paddr;
+static void unlockpair(futex_bucket* a, futex_bucket* b){
+	spinlock_release(&a->lock);
+	if(a != b)
+		spinlock_release(&b->lock);
 }
 
-syscallret syscall_futex(uint32_t *futex, int op, uint32_t v, const struct timespec* tm){
+// a waiter only leaves the queue here if it was actually woken, one that timed out
+// or got interrupted is left for itself to remove, so exactly n are counted
+
+static int wake(futex_bucket* bucket, void* key, size_t n){
 	
-	syscallret retv;
-	retv.ret = -1;
+	int woken = 0;
+	futex_waiter* waiter = bucket->first;
+
+	while(waiter && woken < n){
+		futex_waiter* next = waiter->next;
+		if(waiter->key == key && event_signal(&waiter->event, true)){
+			removewaiter(bucket, waiter);
+			++woken;
+		}
+		waiter = next;
+	}
 
-	if(futex > USER_SPACE_END || tm > USER_SPACE_END){
-		retv.errno = EFAULT;
-		return retv;
+	return woken;
+
+}
+
+static int requeue(futex_bucket* from, void* key, futex_bucket* to, void* newkey, size_t n){
+	
+	int moved = 0;
+	futex_waiter* waiter = from->first;
+
+	while(waiter && moved < n){
+		futex_waiter* next = waiter->next;
+		if(waiter->key == key){
+			removewaiter(from, waiter);
+			__atomic_store_n(&waiter->key, newkey, __ATOMIC_SEQ_CST);
+			addwaiter(to, waiter);
+			++moved;
+		}
+		waiter = next;
 	}
 
-	uint32_t word;
-	spinlock_acquire(&lock);
+	return moved;
+
+}
+
+static void* timeout(arch_regs* ctx, void* arg){
+	futex_waiter* waiter = arg;
+	waiter->timedout = true;
+	event_signal(&waiter->event, false);
+	return NULL;
+}
+
+// the key is the physical address of the word, so shared mappings find each other.
+// reading it first makes sure the page is there
 
-	__atomic_load(futex, &word, __ATOMIC_RELAXED); // TODO copy from userspace with u_memcpy
+static int getkey(uint32_t* futex, void** key, uint32_t* value){
 	
+	if((uintptr_t)futex % sizeof(uint32_t))
+		return EINVAL;
 
-	// TODO safer way of getting the address from userspace while inside the lock
+	int err = u_memcpy(value, futex, sizeof(uint32_t));
 
-	uint32_t* phyfutex = vmm_tophysical(futex);
-	futex_t* f = getfutex(phyfutex);
+	if(err)
+		return err;
 
-	switch(op){
-		case FUTEX_WAKE:
-			// add to waiters left
-			retv.errno = 0;
-			
-			if(!f){
-				retv.ret = 0;
-				break;
-			}
-			
-			retv.ret = v > f->waitercount ? f->waitercount : v;
-			
-			f->waitercount -= retv.ret;
-			f->waitersleft += retv.ret;
+	*key = vmm_tophysical(futex);
 
-			break;			
-			
-				
+	return *key ? 0 : EFAULT;
+
+}
+
+// the word is read through the hhdm under the bucket lock. the page can be
+// unmapped by another thread after getkey, which would fault on the user address
+
+static uint32_t readkey(void* key){
+	return __atomic_load_n((uint32_t*)MAKEHHDM(key), __ATOMIC_SEQ_CST);
+}
+
+static int futexwait(uint32_t* futex, uint32_t v, const struct timespec* tm){
+	
+	void* key;
+	uint32_t word;
+	struct timespec reltime;
+	size_t us = 0;
+
+	int err = getkey(futex, &key, &word);
+
+	if(err)
+		return err;
+
+	if(tm){
+		err = u_memcpy(&reltime, tm, sizeof(struct timespec));
+		if(err)
+			return err;
+		if(reltime.tv_sec < 0 || reltime.tv_nsec < 0 || reltime.tv_nsec > 999999999)
+			return EINVAL;
+		if(reltime.tv_sec > FUTEX_MAXTIMEOUTSEC)
+			reltime.tv_sec = FUTEX_MAXTIMEOUTSEC;
+		us = reltime.tv_sec * 1000000 + (reltime.tv_nsec + 999) / 1000;
+		if(us == 0)
+			return ETIMEDOUT;
+	}
+
+	futex_waiter waiter = {
+		.key = key
+	};
+
+	timer_req req = {
+		.func = timeout,
+		.argptr = &waiter
+	};
+
+	futex_bucket* bucket = getbucket(key);
+
+	spinlock_acquire(&bucket->lock);
+
+	// wakers take the bucket lock, so the value can't change under a waker's nose here
+
+	word = readkey(key);
+
+	if(word != v){
+		spinlock_release(&bucket->lock);
+		return EAGAIN;
+	}
+
+	addwaiter(bucket, &waiter);
+
+	// the timer is queued on this cpu, so it can't fire before the thread is on the event
+
+	if(tm){
+		arch_interrupt_disable();
+		timer_add(&req, us, true);
+	}
+
+	err = event_waitlocked(&waiter.event, true, &bucket->lock);
+
+	if(tm)
+		timer_remove(&req);
+
+	// still queued means no FUTEX_WAKE got to it
+
+	bucket = lockwaiterbucket(&waiter);
+
+	if(waiter.queued){
+		removewaiter(bucket, &waiter);
+		if(!err)
+			err = waiter.timedout ? ETIMEDOUT : EINTR;
+	}
+	else err = 0;
+
+	spinlock_release(&bucket->lock);
+
+	return err;
+
+}
+
+syscallret syscall_futex(uint32_t *futex, int op, uint32_t v, const struct timespec* tm, uint32_t* futex2, uint32_t v3){
+	
+	syscallret retv;
+	retv.ret = -1;
+
+	if(futex > USER_SPACE_END || futex2 > USER_SPACE_END){
+		retv.errno = EFAULT;
+		return retv;
+	}
+
+	void* key;
+	void* key2;
+	uint32_t word;
+	futex_bucket* bucket;
+	futex_bucket* bucket2;
+
+	switch(op & ~FUTEX_PRIVATE_FLAG){
 		case FUTEX_WAIT:
-			if(word != v){
-				retv.errno = EAGAIN;
+			if(tm > USER_SPACE_END){
+				retv.errno = EFAULT;
 				break;
 			}
 
-			if(!f){
-				f = alloc(sizeof(futex_t));
-				if(!f){
-					retv.errno = ENOMEM;
-					break;
-				}
-				setfutex(f, phyfutex);
-			}
-			
-			struct timespec target = arch_timekeeper_gettime();
-
-			if(tm){
-				target.tv_sec += tm->tv_sec;
-				target.tv_nsec += tm->tv_nsec;
-				if(target.tv_nsec > 1000000000){
-					target.tv_sec++;
-					target.tv_nsec %= 1000000000;
-				}
-			}
+			retv.errno = futexwait(futex, v, tm);
 
-			// XXX probably should use events here
+			if(!retv.errno)
+				retv.ret = 0;
 			
-			++f->waitercount;
-
-			spinlock_release(&lock);
+			break;
+			
+		case FUTEX_WAKE:
+			retv.errno = getkey(futex, &key, &word);
 
-			for(;;){	
+			if(retv.errno)
+				break;
 
-				if(spinlock_trytoacquire(&lock)){
+			bucket = getbucket(key);
 
-					if(tm != NULL){
-						struct timespec now = arch_timekeeper_gettime();
-						if(now.tv_sec > target.tv_sec)
-                                			break;
+			spinlock_acquire(&bucket->lock);
+			retv.ret = wake(bucket, key, v);
+			spinlock_release(&bucket->lock);
 
-                        			if(now.tv_sec == target.tv_sec && now.tv_nsec >= target.tv_sec)
-                                			break;
+			break;
+		
+		// the timeout argument is the amount of waiters to requeue
 
-					}
+		case FUTEX_REQUEUE:
+		case FUTEX_CMP_REQUEUE:
+			retv.errno = getkey(futex, &key, &word);
 
-					if(f->waitersleft != 0){
-						--f->waitersleft;
-						--f->waitercount;
-						break;
-					}
+			if(retv.errno)
+				break;
+			
+			retv.errno = getkey(futex2, &key2, &word);
 
-					spinlock_release(&lock);
-				}
+			if(retv.errno)
+				break;
 
-				arch_interrupt_disable();
+			bucket = getbucket(key);
+			bucket2 = getbucket(key2);
 
-				sched_yield();
-		
-				arch_interrupt_enable();
+			lockpair(bucket, bucket2);
+			
+			word = readkey(key);
 
+			if((op & ~FUTEX_PRIVATE_FLAG) == FUTEX_CMP_REQUEUE && word != v3){
+				unlockpair(bucket, bucket2);
+				retv.errno = EAGAIN;
+				break;
 			}
 
-			if(f->waitercount == 0 && f->waitersleft == 0)
-				free(f);
+			retv.ret = wake(bucket, key, v);
+			retv.ret += requeue(bucket, key, bucket2, key2, (uintptr_t)tm);
 
-			retv.ret = 0;
-			retv.errno = 0;
+			unlockpair(bucket, bucket2);
+			
 			break;
+
 		default:
-		retv.errno = ENOSYS;
+			retv.errno = ENOSYS;
 	}
 
-	spinlock_release(&lock);
-
 	return retv;
 
 }
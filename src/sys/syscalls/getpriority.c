@@ -0,0 +1,29 @@
+#include <kernel/syscalls.h>
+#include <kernel/sched.h>
+#include <arch/cls.h>
+#include <errno.h>
+
+// unlike linux the nice value is returned as is, errors go through errno
+
+syscallret syscall_getpriority(int which, id_t who){
+	
+	syscallret retv;
+	retv.ret = -1;
+
+	thread_t* thread = arch_getcls()->thread;
+
+	if(which != PRIO_PROCESS){
+		retv.errno = EINVAL;
+		return retv;
+	}
+
+	if(who != 0 && who != thread->proc->pid){
+		retv.errno = ESRCH;
+		return retv;
+	}
+	
+	retv.errno = 0;
+	retv.ret = thread->nice;
+	return retv;
+
+}
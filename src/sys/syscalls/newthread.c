@@ -23,6 +23,9 @@ syscallret syscall_newthread(void* nip, void* stack){
 	}	
 	
 	new->ctx = thread->ctx;
+	new->nice = thread->nice;
+	sched_copypolicy(new, thread);
+	new->affinity = thread->affinity;
 	
 	sched_queuethread(new);
 
@@ -8,9 +8,110 @@
 #include <arch/timekeeper.h>
 #include <time.h>
 #include <kernel/ustring.h>
+#include <kernel/poll.h>
+#include <kernel/event.h>
+#include <kernel/timer.h>
 
 #define MAXNFDS 4096
 
+// every fd registers on at most 2 events (in and out)
+#define MAXENTRIESPERFD 2
+
+// the first scan registers a callback waiter on every event the fds can be
+// woken up by, after that the thread only rescans when one of them fires
+
+struct _polltable;
+
+typedef struct{
+	event_waiter waiter;
+	event_t* event;
+	struct _polltable* table;
+} pollentry;
+
+typedef struct _polltable{
+	poll_table table;
+	thread_t* thread;
+	pollentry* entries;
+	size_t count;
+	size_t max;
+	bool overflow;
+	bool triggered;
+	bool timedout;
+} polltable;
+
+static void wake(event_waiter* waiter){
+	pollentry* entry = (pollentry*)waiter;
+	__atomic_store_n(&entry->table->triggered, true, __ATOMIC_SEQ_CST);
+	sched_eventsignal(entry->event, waiter->thread);
+}
+
+static void queue(poll_table* ptable, event_t* event){
+	polltable* table = (polltable*)ptable;
+
+	if(table->count == table->max){
+		table->overflow = true;
+		return;
+	}
+
+	pollentry* entry = &table->entries[table->count++];
+	entry->event = event;
+	entry->table = table;
+	entry->waiter.wake = wake;
+	event_addwaiter(event, &entry->waiter, table->thread);
+}
+
+static void* timeout(arch_regs* ctx, void* arg){
+	polltable* table = arg;
+	__atomic_store_n(&table->timedout, true, __ATOMIC_SEQ_CST);
+	__atomic_store_n(&table->triggered, true, __ATOMIC_SEQ_CST);
+	sched_eventsignal(NULL, table->thread);
+	return NULL;
+}
+
+// returns how many fds have events
+
+static size_t scan(fdtable_t* fdtable, pollfd* ilist, int nfds, poll_table* table){
+	
+	size_t eventcount = 0;
+
+	for(uintmax_t i = 0; i < nfds; ++i){
+		if(ilist[i].fd < 0 || ilist[i].events == 0)
+			continue;
+		
+		ilist[i].revents = 0;
+
+		// open fd
+		
+		fd_t* fd;
+
+		int err = fd_access(fdtable, &fd, ilist[i].fd);
+
+		if(err){
+			ilist[i].revents = POLLNVAL;
+			++eventcount;
+			continue;
+		}
+		
+		// poll
+		
+		if(fd->node){
+			if(vfs_poll(fd->node, &ilist[i], table))
+				ilist[i].revents = POLLERR;
+		}
+
+		if(ilist[i].revents)
+			++eventcount;
+
+		// cleanup
+		
+		fd_release(fd);
+		
+	}
+
+	return eventcount;
+
+}
+
 syscallret syscall_poll(pollfd *fds, volatile int nfds, int timeoutms){
 	syscallret retv;
 	retv.ret = -1;
@@ -49,85 +150,103 @@ syscallret syscall_poll(pollfd *fds, volatile int nfds, int timeoutms){
 
 	// check for events and stuff
 
-	bool eventhappened = false;
-
 	fdtable_t* fdtable = &arch_getcls()->thread->proc->fdtable;
 	
-	struct timespec target = arch_timekeeper_gettime();
-	target.tv_sec += timeoutms / 1000;
-	target.tv_nsec += timeoutms * 1000000;
-	if(target.tv_nsec >= 1000000000){
-		target.tv_sec++;
-		target.tv_nsec %= 1000000000;
+	polltable table = {
+		.table.queue = queue,
+		.thread = arch_getcls()->thread
+	};
+	
+	event_waiter sigwaiter = {0};
+	timer_req req = {
+		.func = timeout,
+		.argptr = &table
+	};
+	
+	size_t eventcount = 0;
+	bool interrupted = false;
+
+	if(timeoutms != 0){
+		table.max = nfds * MAXENTRIESPERFD;
+		table.entries = alloc(table.max * sizeof(pollentry));
+		if(!table.entries){
+			free(ilist);
+			retv.errno = ENOMEM;
+			return retv;
+		}
+
+		event_addwaiter(&table.thread->sigevent, &sigwaiter, table.thread);
 	}
 
-	while(!eventhappened){
-		for(uintmax_t i = 0; i < nfds; ++i){
-			if(ilist[i].fd < 0 || ilist[i].events == 0)
-				continue;
-			
-			// open fd
-			
-			fd_t* fd;
-
-			int err = fd_access(fdtable, &fd, ilist[i].fd);
-
-			if(err){
-				ilist[i].revents = POLLNVAL;
-				eventhappened = true;
-				continue;
-			}
-			
-			// poll
-			
-			if(fd->node){
-				if(vfs_poll(fd->node, &ilist[i]))
-					ilist[i].revents = POLLERR;
-			}
-
-			if(ilist[i].revents)
-				eventhappened = true;
-			
-
-			// cleanup
-			
-			fd_release(fd);
-			
-		}	
-		
-		// TODO check for signal or timeout
+	if(timeoutms > 0)
+		timer_add(&req, (uint64_t)timeoutms * 1000, true);
+
+	eventcount = scan(fdtable, ilist, nfds, timeoutms ? &table.table : NULL);
+
+	while(eventcount == 0 && timeoutms != 0){
 		
-		if(timeoutms == 0) break;
-		if(timeoutms > 0){
-			struct timespec now = arch_timekeeper_gettime();
-			if(now.tv_sec > target.tv_sec)
-				break;
-			
-			if(now.tv_sec == target.tv_sec && now.tv_nsec >= target.tv_sec)
-				break;
-			
-		}
 		arch_interrupt_disable();
-		sched_yield();
+
+		table.thread->awokenby = NULL;
+
+		// anything firing from here on either sets triggered or finds the thread blocked
+
+		sched_prepareblock(true);
+
+		if(__atomic_exchange_n(&table.triggered, false, __ATOMIC_SEQ_CST)){
+			sched_cancelblock();
+		}
+		else if(table.overflow){
+			// not every event could be waited on, fall back to rescanning
+			sched_cancelblock();
+			sched_yield();
+		}
+		else{
+			sched_yield();
+			__atomic_store_n(&table.triggered, false, __ATOMIC_SEQ_CST);
+		}
+		
 		arch_interrupt_enable();
 
+		if(table.thread->awokenby == &table.thread->sigevent){
+			interrupted = true;
+			break;
+		}
+
+		eventcount = scan(fdtable, ilist, nfds, NULL);
+
+		if(__atomic_load_n(&table.timedout, __ATOMIC_SEQ_CST))
+			break;
+		
 	}
 
-	// copy results into each fd
+	// the callbacks can run until the waiters are off the events
 
-	size_t eventcount = 0;
+	for(size_t i = 0; i < table.count; ++i)
+		event_removewaiter(table.entries[i].event, &table.entries[i].waiter);
+
+	if(timeoutms != 0)
+		event_removewaiter(&table.thread->sigevent, &sigwaiter);
+
+	if(timeoutms > 0)
+		timer_remove(&req);
+
+	if(table.entries)
+		free(table.entries);
+
+	if(interrupted){
+		free(ilist);
+		retv.errno = EINTR;
+		return retv;
+	}
+
+	// copy results into each fd
 
 	for(int i = 0; i < nfds; ++i){
 		if(ilist[i].fd < 0)
 			continue;
 		
-		if(u_memcpy(&fds[i].revents, &ilist[i].revents, sizeof(ilist[i].revents)))
-				continue;
-		
-		
-		if(ilist[i].revents)
-			++eventcount;
-
+		u_memcpy(&fds[i].revents, &ilist[i].revents, sizeof(ilist[i].revents));
 	}
 
 	retv.errno = 0;
@@ -0,0 +1,47 @@
+#include <kernel/syscalls.h>
+#include <kernel/sched.h>
+#include <kernel/ustring.h>
+#include <kernel/vmm.h>
+#include <arch/cls.h>
+#include <arch/smp.h>
+#include <errno.h>
+
+// like linux, the size has to cover every cpu and be a multiple of a long.
+// returns the number of bytes written
+
+syscallret syscall_sched_getaffinity(pid_t tid, size_t size, void* mask){
+	
+	syscallret retv;
+	retv.ret = -1;
+
+	if(mask > USER_SPACE_END){
+		retv.errno = EFAULT;
+		return retv;
+	}
+
+	if(size * 8 < arch_smp_cpucount() || size % sizeof(long)){
+		retv.errno = EINVAL;
+		return retv;
+	}
+
+	thread_t* thread = sched_findthread(tid);
+
+	if(!thread){
+		retv.errno = ESRCH;
+		return retv;
+	}
+
+	cpuset_t set = thread->affinity;
+
+	if(size > sizeof(cpuset_t))
+		size = sizeof(cpuset_t);
+
+	retv.errno = u_memcpy(mask, &set, size);
+
+	if(retv.errno)
+		return retv;
+
+	retv.ret = size;
+	return retv;
+
+}
@@ -0,0 +1,38 @@
+#include <kernel/syscalls.h>
+#include <kernel/sched.h>
+#include <kernel/ustring.h>
+#include <kernel/vmm.h>
+#include <errno.h>
+
+// the priority is 0 for SCHED_OTHER threads
+
+syscallret syscall_sched_getparam(pid_t tid, struct sched_param* uparam){
+	
+	syscallret retv;
+	retv.ret = -1;
+
+	if(uparam > USER_SPACE_END){
+		retv.errno = EFAULT;
+		return retv;
+	}
+
+	thread_t* thread = sched_findthread(tid);
+
+	if(!thread){
+		retv.errno = ESRCH;
+		return retv;
+	}
+
+	struct sched_param param = {
+		.sched_priority = thread->rtpriority
+	};
+
+	retv.errno = u_memcpy(uparam, &param, sizeof(struct sched_param));
+
+	if(retv.errno)
+		return retv;
+
+	retv.ret = 0;
+	return retv;
+
+}
@@ -0,0 +1,21 @@
+#include <kernel/syscalls.h>
+#include <kernel/sched.h>
+#include <errno.h>
+
+syscallret syscall_sched_getscheduler(pid_t tid){
+	
+	syscallret retv;
+	retv.ret = -1;
+
+	thread_t* thread = sched_findthread(tid);
+
+	if(!thread){
+		retv.errno = ESRCH;
+		return retv;
+	}
+
+	retv.errno = 0;
+	retv.ret = thread->policy;
+	return retv;
+
+}
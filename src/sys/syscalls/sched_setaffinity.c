@@ -0,0 +1,55 @@
+#include <kernel/syscalls.h>
+#include <kernel/sched.h>
+#include <kernel/ustring.h>
+#include <kernel/vmm.h>
+#include <arch/cls.h>
+#include <arch/spinlock.h>
+#include <arch/interrupt.h>
+#include <string.h>
+#include <errno.h>
+
+syscallret syscall_sched_setaffinity(pid_t tid, size_t size, void* mask){
+	
+	syscallret retv;
+	retv.ret = -1;
+
+	if(mask > USER_SPACE_END){
+		retv.errno = EFAULT;
+		return retv;
+	}
+
+	thread_t* thread = sched_findthread(tid);
+
+	if(!thread){
+		retv.errno = ESRCH;
+		return retv;
+	}
+
+	cpuset_t set;
+	cpuset_clear(&set);
+
+	if(size > sizeof(cpuset_t))
+		size = sizeof(cpuset_t);
+
+	retv.errno = u_memcpy(&set, mask, size);
+
+	if(retv.errno)
+		return retv;
+
+	retv.errno = sched_setaffinity(thread, &set);
+
+	if(retv.errno)
+		return retv;
+
+	// get off this cpu right away if it isn't allowed anymore
+
+	if(thread == arch_getcls()->thread && !cpuset_isset(&thread->affinity, arch_getcls()->cpunum)){
+		arch_interrupt_disable();
+		sched_yield();
+		arch_interrupt_enable();
+	}
+
+	retv.ret = 0;
+	return retv;
+
+}
@@ -0,0 +1,56 @@
+#include <kernel/syscalls.h>
+#include <kernel/sched.h>
+#include <kernel/ustring.h>
+#include <kernel/vmm.h>
+#include <arch/cls.h>
+#include <arch/interrupt.h>
+#include <errno.h>
+
+// only a root caller can make a thread real time, anyone can go back to SCHED_OTHER
+
+syscallret syscall_sched_setscheduler(pid_t tid, int policy, struct sched_param* uparam){
+	
+	syscallret retv;
+	retv.ret = -1;
+
+	if(uparam > USER_SPACE_END){
+		retv.errno = EFAULT;
+		return retv;
+	}
+
+	struct sched_param param;
+
+	retv.errno = u_memcpy(&param, uparam, sizeof(struct sched_param));
+
+	if(retv.errno)
+		return retv;
+
+	thread_t* thread = sched_findthread(tid);
+
+	if(!thread){
+		retv.errno = ESRCH;
+		return retv;
+	}
+
+	if(policy != SCHED_OTHER && arch_getcls()->thread->proc->uid != 0){
+		retv.errno = EPERM;
+		return retv;
+	}
+
+	retv.errno = sched_setscheduler(thread, policy, param.sched_priority);
+
+	if(retv.errno)
+		return retv;
+
+	// let the queues decide again with the new policy
+
+	if(thread == arch_getcls()->thread){
+		arch_interrupt_disable();
+		sched_yield();
+		arch_interrupt_enable();
+	}
+
+	retv.ret = 0;
+	return retv;
+
+}
@@ -0,0 +1,55 @@
+#include <kernel/syscalls.h>
+#include <kernel/sched.h>
+#include <arch/cls.h>
+#include <arch/spinlock.h>
+#include <errno.h>
+
+// only PRIO_PROCESS on the calling process is supported for now.
+// the nice value is applied to every thread in the process
+
+syscallret syscall_setpriority(int which, id_t who, int prio){
+	
+	syscallret retv;
+	retv.ret = -1;
+
+	proc_t* proc = arch_getcls()->thread->proc;
+
+	if(which != PRIO_PROCESS){
+		retv.errno = EINVAL;
+		return retv;
+	}
+
+	if(who != 0 && who != proc->pid){
+		retv.errno = ESRCH;
+		return retv;
+	}
+
+	if(prio < SCHED_NICE_MIN)
+		prio = SCHED_NICE_MIN;
+	if(prio > SCHED_NICE_MAX)
+		prio = SCHED_NICE_MAX;
+
+	spinlock_acquire(&proc->lock);
+	
+	// only root can raise the priority
+	
+	if(proc->uid != 0){
+		for(size_t i = 0; i < proc->threadcount; ++i){
+			if(prio < proc->threads[i]->nice){
+				spinlock_release(&proc->lock);
+				retv.errno = EACCES;
+				return retv;
+			}
+		}
+	}
+
+	for(size_t i = 0; i < proc->threadcount; ++i)
+		__atomic_store_n(&proc->threads[i]->nice, prio, __ATOMIC_SEQ_CST);
+
+	spinlock_release(&proc->lock);
+
+	retv.errno = 0;
+	retv.ret = 0;
+	return retv;
+
+}
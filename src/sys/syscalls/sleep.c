@@ -2,9 +2,20 @@
 #include <time.h>
 #include <arch/timekeeper.h>
 #include <kernel/sched.h>
+#include <kernel/event.h>
+#include <kernel/timer.h>
+#include <kernel/ustring.h>
 #include <arch/interrupt.h>
+#include <arch/cls.h>
+#include <errno.h>
 
-// XXX proper implementation and not a hacky stub
+// longer sleeps are cut down to this, so the deadline can't wrap
+#define SLEEP_MAXSEC (1ul << 32)
+
+static void* wakeup(arch_regs* ctx, void* arg){
+	event_signal(arg, false);
+	return NULL;
+}
 
 syscallret syscall_nanosleep(struct timespec *time, struct timespec *remaining){
 	
@@ -16,48 +27,68 @@ syscallret syscall_nanosleep(struct timespec *time, struct timespec *remaining){
 		return retv;
 	}
 
-	struct timespec t = *time;
+	struct timespec t;
 
-	if(t.tv_nsec > 999999999 || t.tv_nsec < 0){
+	retv.errno = u_memcpy(&t, time, sizeof(struct timespec));
+
+	if(retv.errno)
+		return retv;
+
+	if(t.tv_nsec > 999999999 || t.tv_nsec < 0 || t.tv_sec < 0){
 		retv.errno = EINVAL;
 		return retv;
 	}
 
-	struct timespec start = arch_timekeeper_gettime();
-	struct timespec end = start;
-	end.tv_sec += t.tv_sec;
-	end.tv_nsec += t.tv_nsec;
+	if(t.tv_sec > SLEEP_MAXSEC)
+		t.tv_sec = SLEEP_MAXSEC;
 
-	if(end.tv_nsec / 999999999){
-		++end.tv_sec;
-		end.tv_nsec %= 999999999;
-	}
+	uint64_t requested = t.tv_sec * 1000000000ul + t.tv_nsec;
+	
+	retv.errno = 0;
+	retv.ret = 0;
+
+	if(requested == 0)
+		return retv;
+
+	event_t event = {0};
+	timer_req req = {
+		.func = wakeup,
+		.argptr = &event
+	};
+
+	// interrupts stay off until the thread is on the event, the timer is queued on this cpu
+	// so it can't fire before that
 
-	for(;;){
-		
-		struct timespec current = arch_timekeeper_gettime();
-		
-		if(current.tv_sec > end.tv_sec)
-			break;
+	arch_interrupt_disable();
 
-		if(current.tv_sec == end.tv_sec && current.tv_nsec > end.tv_nsec)
-			break;
-		
-		arch_interrupt_disable();
+	struct timespec start = arch_timekeeper_gettimefromboot();
 
-		sched_yield();
+	timer_add(&req, (requested + 999) / 1000, true);
 
-		arch_interrupt_enable();
-		
+	int err = event_wait(&event, true);
+
+	timer_remove(&req);
+
+	if(!err)
+		return retv;
+
+	struct timespec end = arch_timekeeper_gettimefromboot();
+	uint64_t elapsed = (end.tv_sec - start.tv_sec) * 1000000000ul + end.tv_nsec - start.tv_nsec;
+	uint64_t left = elapsed < requested ? requested - elapsed : 0;
+
+	retv.ret = -1;
+	retv.errno = err;
+
+	if(remaining){
+		struct timespec r = {
+			.tv_sec = left / 1000000000,
+			.tv_nsec = left % 1000000000
+		};
+		int uerr = u_memcpy(remaining, &r, sizeof(struct timespec));
+		if(uerr)
+			retv.errno = uerr;
 	}
-	
-	remaining->tv_nsec = 0;
-	remaining->tv_sec = 0;
-	
-	retv.errno = 0;
-	retv.ret = 0;
 
 	return retv;
 
-
 }
@@ -101,16 +101,34 @@ syscallret syscall_waitpid(pid_t pid, int *status, int options){
 		
 	}
 	int threadc = child->threadcount;
+
+	// the child is a zombie before its threads have left their cpus, which
+	// may still be running on their kernel stacks with the context loaded
+
+	for(int t = 0; t < threadc; ++t){
+		
+		thread_t* thread = child->threads[t];
+
+		while(__atomic_load_n(&thread->state, __ATOMIC_ACQUIRE) != THREAD_STATE_DEAD || __atomic_load_n(&thread->oncpu, __ATOMIC_ACQUIRE))
+			asm volatile("pause");
+
+	}
 	
-	// free all the threads
+	// free all the threads. threads made with newthread share their
+	// context, so each one is only destroyed once
 
 	for(int t = 0; t < threadc; ++t){
 		
 		thread_t* thread = child->threads[t];
+		bool shared = false;
+
+		for(int o = 0; o < t; ++o){
+			if(child->threads[o]->ctx == thread->ctx)
+				shared = true;
+		}
 
-		free(thread->regs);
-		free(thread->kernelstackbase);
-		vmm_destroy(thread->ctx);
+		if(!shared)
+			vmm_destroy(thread->ctx);
 
 		thread->state = THREAD_STATE_DESTROYED;
 
@@ -123,13 +141,14 @@ syscallret syscall_waitpid(pid_t pid, int *status, int options){
 		if(thread->state != THREAD_STATE_DESTROYED)
 			_panic("Freeing non-destroyed thread", NULL);
 
-		free(thread);
+		sched_freethread(thread);
 
 	}
 	
-	free(child);
-	
 	retv.ret = child->pid;
+
+	sched_freeproc(child);
+	
 	retv.errno = 0;
 	return retv;
 
@@ -1,116 +1,189 @@
 #include <kernel/timer.h>
 #include <arch/cputimer.h>
 #include <arch/cls.h>
+#include <arch/smp.h>
+#include <arch/spinlock.h>
+#include <arch/interrupt.h>
+#include <arch/timekeeper.h>
 #include <stdio.h>
 
+// requests are kept in a per cpu tree ordered by their absolute deadline (ns since boot).
+// the cpu timer is only armed for the earliest one and left stopped when nothing is
+// queued, so an idle cpu gets no ticks.
+// the trees are only touched with their cpu's lock held and interrupts off, as the
+// lock is also taken from the timer interrupt. requests are only added on the local
+// cpu but can be removed from any
+
+static int deadlinecmp(rbnode_t* a, rbnode_t* b){
+	uint64_t da = RBTREE_ENTRY(a, timer_req, node)->deadline;
+	uint64_t db = RBTREE_ENTRY(b, timer_req, node)->deadline;
+	// equal deadlines go after the ones already queued
+	return da < db ? -1 : 1;
+}
+
+static cls_t* getcpu(size_t cpunum){
+	cls_t* self = arch_getcls();
+	return self->cpunum == cpunum ? self : arch_smp_getcls(cpunum);
+}
+
+uint64_t timer_now(){
+	return arch_timekeeper_nsfromboot();
+}
+
 void timer_init(){
 	cls_t* cls = arch_getcls();
+	rbtree_init(&cls->timers, deadlinecmp);
 	cls->timerticksperus = arch_cputimer_init();
-	printf("CPU%d: CPUTIMER tick: %lu per us\n", cls->lapicid, cls->timerticksperus);
+	printf("CPU%d: CPUTIMER tick: %lu per us%s\n", cls->lapicid, cls->timerticksperus, cls->tscdeadline ? " (tsc deadline)" : "");
 }
 
-void timer_irq(arch_regs* ctx){
+// expects the local cpu's lock to be held
 
-	timer_req* pendingreq = arch_getcls()->timerfirstreq;
-	timer_req* iter = pendingreq->next;
+static void arm(cls_t* cls, uint64_t now){
 
-	if(arch_getcls()->timerpending){ // if we know we stopped, don't do anything yet
-		while(iter){
-			iter->ticks -= pendingreq->ticks;
-			iter = iter->next;
-		}
-		return;
-	}
+	rbnode_t* first = rbtree_first(&cls->timers);
 
-	arch_getcls()->timerfirstreq = iter;
+	if(first)
+		arch_cputimer_arm(RBTREE_ENTRY(first, timer_req, node)->deadline, now);
+	else
+		arch_cputimer_stop();
+
+}
+
+void timer_irq(arch_regs* ctx){
 	
+	cls_t* cls = arch_getcls();
+	uint64_t now = timer_now();
 
+	ticketlock_acquire(&cls->timerlock);
 
-	while(iter){
-		iter->ticks -= pendingreq->ticks;
-		if(iter->ticks == 0){
-			iter->func(ctx, iter->argptr);
-			arch_getcls()->timerfirstreq = iter->next;
-		}
-		iter = iter->next;
-	}
+	// early or late interrupts find nothing expired and just rearm
+
+	for(rbnode_t* first = rbtree_first(&cls->timers); first; first = rbtree_first(&cls->timers)){
+		
+		timer_req* req = RBTREE_ENTRY(first, timer_req, node);
+		
+		if(req->deadline > now)
+			break;
 
-	pendingreq->func(ctx, pendingreq->argptr);
+		rbtree_remove(&cls->timers, first);
+		req->queuedon = 0;
+		req->running = cls->cpunum + 1;
+
+		ticketlock_release(&cls->timerlock);
+
+		// the callbacks are free to queue the request again
+
+		req->func(ctx, req->argptr);
+
+		__atomic_store_n(&req->running, 0, __ATOMIC_RELEASE);
+
+		ticketlock_acquire(&cls->timerlock);
+
+	}
 	
-	if(!arch_getcls()->timerfirstreq) return;
+	arm(cls, now);
 
-	arch_cputimer_fire(arch_getcls()->timerfirstreq->ticks);
+	ticketlock_release(&cls->timerlock);
 
 }
 
 void timer_resume(){
-	if(arch_getcls()->timerpending){ // if an int was pending, have it happen
-		timer_req* iter = arch_getcls()->timerfirstreq;
-		while(iter){
-			iter->ticks++;
-			iter = iter->next;
-		}
-		arch_getcls()->timerpending = false;
-	}
-	arch_cputimer_fire(arch_getcls()->timerfirstreq->ticks);
+	
+	cls_t* cls = arch_getcls();
+	bool intstate = ticketlock_acquireirqsave(&cls->timerlock);
+
+	arm(cls, timer_now());
+
+	ticketlock_releaseirqrestore(&cls->timerlock, intstate);
+
 }
 
 void timer_stop(){
+	arch_cputimer_stop();
+}
+
+// a request that is still queued has to be removed first
+
+void timer_addabs(timer_req* req, uint64_t deadline, bool start){
 	
-	size_t remainingticks = arch_cputimer_stop();
-	timer_req* iter = arch_getcls()->timerfirstreq;
-	if(!iter) return;
-	
-	if(remainingticks == 0) // interrupt is pending
-		arch_getcls()->timerpending = true;
+	cls_t* cls = arch_getcls();
+	bool intstate = ticketlock_acquireirqsave(&cls->timerlock);
+
+	req->deadline = deadline;
+	req->queuedon = cls->cpunum + 1;
+	rbtree_insert(&cls->timers, &req->node);
+
+	if(start)
+		arm(cls, timer_now());
+
+	ticketlock_releaseirqrestore(&cls->timerlock, intstate);
 
-	size_t subticks = iter->ticks - remainingticks;
-	while(iter){
-		iter->ticks -= subticks;
-		iter = iter->next;
-	}
 }
 
 void timer_add(timer_req* req, size_t us, bool start){
-	size_t remainingticks = arch_cputimer_stop();
+	timer_addabs(req, timer_now() + us * 1000, start);
+}
 
-	timer_req* iter = arch_getcls()->timerfirstreq;
+// returns false if the request wasn't queued anymore.
+// if its callback is running on another cpu this waits for it to return
 
-	
-	req->ticks = us*arch_getcls()->timerticksperus;
-
-	if(!iter){
-		arch_getcls()->timerfirstreq = req;
-		req->next = NULL;
-		if(start);
-			arch_cputimer_fire(req->ticks);
-		return;
-	}
-	
-	size_t subticks = iter->ticks - remainingticks;
+bool timer_remove(timer_req* req){
 
-	while(iter){
-		iter->ticks -= subticks;
-		iter = iter->next;
-	}
+	bool intstate = arch_interrupt_save();
+	bool removed = false;
+	cls_t* self = arch_getcls();
 
-	iter = arch_getcls()->timerfirstreq;
-	
-	if(iter->ticks > req->ticks){
-		req->next = arch_getcls()->timerfirstreq;
-		arch_getcls()->timerfirstreq = req;
-		if(start)
-			arch_cputimer_fire(req->ticks);
-		return;
+	for(;;){
+		size_t queuedon = __atomic_load_n(&req->queuedon, __ATOMIC_ACQUIRE);
+
+		if(queuedon == 0)
+			break;
+
+		cls_t* cls = getcpu(queuedon - 1);
+
+		ticketlock_acquire(&cls->timerlock);
+
+		// it might have fired or moved before the lock was taken
+
+		if(req->queuedon == queuedon){
+			rbtree_remove(&cls->timers, &req->node);
+			req->queuedon = 0;
+			removed = true;
+			
+			// a remote cpu just gets an early interrupt
+			if(cls == self)
+				arm(cls, timer_now());
+		}
+
+		ticketlock_release(&cls->timerlock);
+
+		if(removed)
+			break;
 	}
 
-	while(iter->next && iter->next->ticks <= req->ticks)
-		iter = iter->next;
-	
-	req->next = iter->next;
-	iter->next = req;
+	// a callback removing its own request doesn't wait for itself
+
+	size_t running;
+	while((running = __atomic_load_n(&req->running, __ATOMIC_ACQUIRE)) && running != self->cpunum + 1)
+		asm("pause");
+
+	arch_interrupt_restore(intstate);
+
+	return removed;
+
+}
+
+// moves a queued request to the calling cpu, keeping its deadline.
+// once this returns the request either fires on this cpu or its callback is done
+
+void timer_migrate(timer_req* req){
+
+	bool intstate = arch_interrupt_save();
+
+	if(timer_remove(req))
+		timer_addabs(req, req->deadline, true);
+
+	arch_interrupt_restore(intstate);
 
-	if(start)
-		arch_cputimer_fire(arch_getcls()->timerfirstreq->ticks);
-	
 }
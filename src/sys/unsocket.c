@@ -244,7 +244,7 @@ int unsocket_send(socket_t* socket, void* buff, size_t len, int flags, int* erro
 	
 		
 		if(writec > 0){
-			event_signal(&peer->dataevent, true);
+			event_signalone(&peer->dataevent, true);
 			break;
 		}
 
@@ -256,7 +256,7 @@ int unsocket_send(socket_t* socket, void* buff, size_t len, int flags, int* erro
 		spinlock_release(&peer->lock);
 		
 
-		if(event_wait(&peer->dataevent, true)){
+		if(event_wait(&peer->spaceevent, true)){
 			spinlock_acquire(&peer->lock);
 			writec = -1;
 			break;
@@ -304,7 +304,7 @@ int unsocket_recv(socket_t* socket, void* buff, size_t len, int flags, int* erro
 		arch_interrupt_enable();
 
 		if(readc > 0){
-			event_signal(&socket->dataevent, true);
+			event_signalone(&socket->spaceevent, true);
 			break;
 		}
 
@@ -333,13 +333,18 @@ int unsocket_recv(socket_t* socket, void* buff, size_t len, int flags, int* erro
 	return readc;
 }
 
-int unsocket_poll(socket_t* socket, pollfd* fd){
+// data arrives in our buffer and is sent into the peer's
+
+int unsocket_poll(socket_t* socket, pollfd* fd, poll_table* table){
 	spinlock_acquire(&socket->lock);
 
 	// TODO outgoing connect finished
 
 	switch(socket->state){
 		case SOCKET_STATE_LISTENING:
+			if(fd->events & POLLIN)
+				poll_wait(table, &socket->connectevent);
+
 			if((fd->events & POLLIN) && socket->backlogend){
 				fd->revents |= POLLIN;
 			}
@@ -347,20 +352,26 @@ int unsocket_poll(socket_t* socket, pollfd* fd){
 			break;
 		case SOCKET_STATE_CONNECTED:
 
-			if(!socket->peer)
+			if(fd->events & POLLIN)
+				poll_wait(table, &socket->dataevent);
+
+			if(!socket->peer){
 				fd->revents |= POLLHUP;
+				break;
+			}
+
+			if(fd->events & POLLOUT)
+				poll_wait(table, &socket->peer->spaceevent);
 
 			if((fd->events & POLLIN) && socket->buffer.write != socket->buffer.read){
                         	fd->revents |= POLLIN;
 			}
 
-			if((fd->events & POLLOUT) && socket->buffer.write != socket->buffer.read + socket->buffer.size){
+			if((fd->events & POLLOUT) && socket->peer->buffer.write != socket->peer->buffer.read + socket->peer->buffer.size){
 				fd->revents |= POLLOUT;
 			}
 
 			break;
-		default:
-			return 0;
 	}
 
 	spinlock_release(&socket->lock);
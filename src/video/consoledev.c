@@ -265,8 +265,14 @@ static int ioctl(int minor, unsigned long req, void* arg){
 
 #include <poll.h>
 
-static int poll(int minor, pollfd* fd){
+static int poll(int minor, pollfd* fd, poll_table* table){
 	
+	if(fd->events & POLLIN)
+		poll_wait(table, &inputevent);
+
+	if(fd->events & POLLOUT)
+		poll_wait(table, &outputevent);
+
 	if((fd->events & POLLIN) && input.write != input.read)
 		fd->revents |= POLLIN;
 	
@@ -294,10 +300,17 @@ void consoledev_init(){
 	if(ringbuffer_init(&input, THREAD_BUFF_MAX))
 		_panic("Failed to initialise console ringbuffer", 0);
 
-	thread = sched_newkthread(console_thread, THREAD_DEFAULT_KSTACK_SIZE, true, THREAD_PRIORITY_KERNEL);
+	thread = sched_newkthread(console_thread, THREAD_DEFAULT_KSTACK_SIZE, false, THREAD_PRIORITY_KERNEL);
 
 	if(!thread)
 		_panic("Failed to initialise console thread", 0);
+	
+	// the console is driven by the keyboard interrupt, which goes to the bsp
+
+	cpuset_clear(&thread->affinity);
+	cpuset_set(&thread->affinity, 0);
+
+	sched_queuethread(thread);
 
 	tty.c_iflag = ICRNL;
 	tty.c_lflag = ECHO | ICANON | ISIG;